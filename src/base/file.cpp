@@ -39,6 +39,12 @@ HANDLE OpenFileForGenericWrite(const std::wstring& path) {
                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
 }
 
+HANDLE OpenFileForAppend(const std::wstring& path) {
+  return ::CreateFile(GetExtendedLengthPath(path).c_str(),
+                      FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+                      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 unsigned long GetFileAge(const std::wstring& path) {
@@ -360,6 +366,22 @@ bool SaveToFile(const std::string& data, const std::wstring& path,
   return SaveToFile((LPCVOID)&data.front(), data.size(), path, take_backup);
 }
 
+bool AppendToFile(const std::string& data, const std::wstring& path) {
+  // Make sure the path is available
+  CreateFolder(GetPathOnly(path));
+
+  BOOL result = FALSE;
+  HANDLE file_handle = OpenFileForAppend(path);
+  if (file_handle != INVALID_HANDLE_VALUE) {
+    DWORD bytes_written = 0;
+    result = ::WriteFile(file_handle, data.data(), data.size(),
+                         &bytes_written, nullptr);
+    ::CloseHandle(file_handle);
+  }
+
+  return result != FALSE;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 std::wstring ToSizeString(QWORD qwSize) {
@@ -57,9 +57,12 @@ int PopulateFolders(std::vector<std::wstring>& folder_list, const std::wstring&
 bool ReadFromFile(const std::wstring& path, std::string& output);
 bool SaveToFile(LPCVOID data, DWORD length, const std::wstring& path, bool take_backup = false);
 bool SaveToFile(const std::string& data, const std::wstring& path, bool take_backup = false);
+bool AppendToFile(const std::string& data, const std::wstring& path);
 
 std::wstring ToSizeString(QWORD qwSize);
 
+class DirectoryCache;
+
 class FileSearchHelper {
 public:
   typedef std::function<bool(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data)> callback_function_t;
@@ -72,12 +75,18 @@ public:
 
   virtual bool OnDirectory(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data);
   virtual bool OnFile(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data);
+  // Called after the walk, so that entries that were held back by the
+  // callbacks can be handled. Returns true if the search should be regarded
+  // as stopped.
+  virtual bool OnSearchEnd(bool stopped);
 
+  void set_directory_cache(DirectoryCache* directory_cache);
   void set_skip_directories(bool skip_directories);
   void set_skip_files(bool skip_files);
   void set_skip_subdirectories(bool skip_subdirectories);
 
 protected:
+  DirectoryCache* directory_cache_;
   ULONGLONG minimum_file_size_;
   bool skip_directories_;
   bool skip_files_;
@@ -0,0 +1,314 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "file_change_queue.h"
+
+#ifndef _WIN32
+#include <codecvt>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <locale>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FileChangeQueue::FileChangeQueue(size_t max_changes)
+    : max_changes_(max_changes),
+      overflow_(false) {
+}
+
+void FileChangeQueue::Add(Action action, bool directory,
+                          const std::wstring& path,
+                          const std::wstring& old_path) {
+  if (overflow_)
+    return;
+
+  if (directory) {
+    files_.clear();
+    Change change;
+    change.action = action;
+    change.directory = true;
+    change.path = path;
+    change.old_path = old_path;
+    changes_.push_back(change);
+  } else {
+    switch (action) {
+      case kAdded:
+        AddFile(true, path);
+        break;
+      case kRemoved:
+        AddFile(false, path);
+        break;
+      case kRenamed:
+        AddFile(false, old_path);
+        AddFile(true, path);
+        break;
+    }
+  }
+
+  if (changes_.size() > max_changes_)
+    SetOverflow();
+}
+
+void FileChangeQueue::AddFile(bool available, const std::wstring& path) {
+  Action action = available ? kAdded : kRemoved;
+
+  auto it = files_.find(path);
+  if (it == files_.end()) {
+    FileState state = {changes_.size(), !available};
+    files_.insert(std::make_pair(path, state));
+    Change change;
+    change.action = action;
+    change.directory = false;
+    change.path = path;
+    changes_.push_back(change);
+    return;
+  }
+
+  // A file that is removed before it's handled doesn't have to be handled at
+  // all, unless it existed before. An empty path marks such changes.
+  Change& change = changes_.at(it->second.index);
+  change.action = action;
+  change.path = available || it->second.existed ? path : L"";
+}
+
+void FileChangeQueue::Clear() {
+  changes_.clear();
+  files_.clear();
+  overflow_ = false;
+}
+
+bool FileChangeQueue::IsEmpty() const {
+  return !overflow_ && changes_.empty();
+}
+
+void FileChangeQueue::SetOverflow() {
+  changes_.clear();
+  files_.clear();
+  overflow_ = true;
+}
+
+bool FileChangeQueue::Take(std::vector<Change>& changes) {
+  bool overflow = overflow_;
+
+  changes.clear();
+  if (!overflow) {
+    for (auto it = changes_.begin(); it != changes_.end(); ++it)
+      if (!it->path.empty())
+        changes.push_back(*it);
+  }
+
+  Clear();
+
+  return overflow;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+static bool ToWide(const std::string& str, std::wstring& output) {
+  std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+  try {
+    output = converter.from_bytes(str);
+  } catch (const std::range_error&) {
+    return false;
+  }
+  return true;
+}
+
+InotifyMonitor::InotifyMonitor()
+    : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      buffer_(65536) {
+}
+
+InotifyMonitor::~InotifyMonitor() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool InotifyMonitor::Add(const std::wstring& path) {
+  std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+  std::string native_path;
+  try {
+    native_path = converter.to_bytes(path);
+  } catch (const std::range_error&) {
+    return false;
+  }
+
+  while (native_path.size() > 1 && native_path.back() == '/')
+    native_path.pop_back();
+
+  return AddWatch(native_path, true);
+}
+
+void InotifyMonitor::Clear() {
+  for (auto it = watches_.begin(); it != watches_.end(); ++it)
+    inotify_rm_watch(fd_, it->first);
+  watches_.clear();
+}
+
+bool InotifyMonitor::Read(FileChangeQueue& queue, int timeout) {
+  if (fd_ < 0)
+    return false;
+
+  pollfd poll_fd = {fd_, POLLIN, 0};
+  if (poll(&poll_fd, 1, timeout) <= 0)
+    return false;
+
+  // The two halves of a move share a cookie, and are reported one after the
+  // other. A move without its other half is a file leaving or entering the
+  // watched trees.
+  bool moved_directory = false;
+  uint32_t moved_cookie = 0;
+  std::wstring moved_path;
+  std::string moved_native_path;
+  auto flush_move = [&]() {
+    if (moved_path.empty())
+      return;
+    if (moved_directory)
+      RemoveWatches(moved_native_path);
+    queue.Add(FileChangeQueue::kRemoved, moved_directory, moved_path);
+    moved_path.clear();
+  };
+
+  while (true) {
+    ssize_t length = read(fd_, buffer_.data(), buffer_.size());
+    if (length <= 0)
+      break;
+
+    for (ssize_t offset = 0; offset < length; ) {
+      const inotify_event* event =
+          reinterpret_cast<const inotify_event*>(buffer_.data() + offset);
+      offset += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        queue.SetOverflow();
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        watches_.erase(event->wd);
+        continue;
+      }
+
+      // A pending move is flushed before the watch of any other event is
+      // looked up, as flushing removes the watches of a directory that has
+      // left the watched trees. Events from those watches are then skipped.
+      bool move_completed = (event->mask & IN_MOVED_TO) &&
+                            !moved_path.empty() &&
+                            event->cookie == moved_cookie;
+      if (!move_completed)
+        flush_move();
+
+      auto watch = watches_.find(event->wd);
+      if (watch == watches_.end() || event->len == 0)
+        continue;
+
+      std::string native_path = watch->second + event->name;
+      std::wstring path;
+      if (!ToWide(native_path, path))
+        continue;
+      bool directory = (event->mask & IN_ISDIR) != 0;
+
+      if (move_completed) {
+        if (directory)
+          RenameWatches(moved_native_path, native_path);
+        queue.Add(FileChangeQueue::kRenamed, directory, path, moved_path);
+        moved_path.clear();
+        continue;
+      }
+
+      if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        if (directory)
+          AddWatch(native_path, true);
+        queue.Add(FileChangeQueue::kAdded, directory, path);
+      } else if (event->mask & IN_DELETE) {
+        queue.Add(FileChangeQueue::kRemoved, directory, path);
+      } else if (event->mask & IN_MOVED_FROM) {
+        moved_directory = directory;
+        moved_cookie = event->cookie;
+        moved_path = path;
+        moved_native_path = native_path;
+      }
+    }
+  }
+
+  flush_move();
+
+  return true;
+}
+
+bool InotifyMonitor::AddWatch(const std::string& path, bool recursive) {
+  const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                        IN_ONLYDIR;
+  int wd = inotify_add_watch(fd_, path.c_str(), mask);
+  if (wd < 0)
+    return false;
+
+  watches_[wd] = path == "/" ? path : path + "/";
+
+  if (recursive) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+      return true;
+    while (dirent* dir_entry = readdir(dir)) {
+      const char* name = dir_entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        continue;
+      // Symbolic links are not followed, so that watches can't loop
+      bool directory = dir_entry->d_type == DT_DIR;
+      if (dir_entry->d_type == DT_UNKNOWN) {
+        struct stat file_stat;
+        directory = fstatat(dirfd(dir), name, &file_stat,
+                            AT_SYMLINK_NOFOLLOW) == 0 &&
+                    S_ISDIR(file_stat.st_mode);
+      }
+      if (directory)
+        AddWatch(watches_[wd] + name, true);
+    }
+    closedir(dir);
+  }
+
+  return true;
+}
+
+void InotifyMonitor::RenameWatches(const std::string& old_path,
+                                   const std::string& new_path) {
+  std::string old_prefix = old_path + "/";
+  for (auto it = watches_.begin(); it != watches_.end(); ++it)
+    if (it->second.compare(0, old_prefix.size(), old_prefix) == 0)
+      it->second = new_path + "/" + it->second.substr(old_prefix.size());
+}
+
+void InotifyMonitor::RemoveWatches(const std::string& path) {
+  std::string prefix = path + "/";
+  for (auto it = watches_.begin(); it != watches_.end(); ) {
+    if (it->second.compare(0, prefix.size(), prefix) == 0) {
+      inotify_rm_watch(fd_, it->first);
+      watches_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_FILE_CHANGE_QUEUE_H
+#define TAIGA_BASE_FILE_CHANGE_QUEUE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Collects file system changes until they're handled, merging the changes
+// that were made to the same file. Programs such as torrent clients tend to
+// create, rename and delete files in bursts, and only the final state of each
+// file matters.
+//
+// This file does not depend on the rest of the application, so that it can be
+// built on other platforms. An inotify based monitor is provided for Linux.
+
+class FileChangeQueue {
+public:
+  enum Action {
+    kAdded,
+    kRemoved,
+    kRenamed  // Only reported for directories, files are removed and added
+  };
+
+  struct Change {
+    Action action;
+    bool directory;
+    std::wstring path;
+    std::wstring old_path;  // Renamed directories only
+  };
+
+  explicit FileChangeQueue(size_t max_changes = 1000);
+  ~FileChangeQueue() {}
+
+  void Add(Action action, bool directory, const std::wstring& path,
+           const std::wstring& old_path = L"");
+  void Clear();
+  bool IsEmpty() const;
+
+  // Called when the system couldn't keep up with the changes
+  void SetOverflow();
+
+  // Returns true if changes were lost, in which case everything has to be
+  // scanned again and no changes are returned
+  bool Take(std::vector<Change>& changes);
+
+private:
+  void AddFile(bool available, const std::wstring& path);
+
+  struct FileState {
+    size_t index;
+    bool existed;  // Before the first change
+  };
+
+  std::vector<Change> changes_;
+  // Directory changes act as barriers, files are merged only with the changes
+  // that were made after the last one
+  std::map<std::wstring, FileState> files_;
+  size_t max_changes_;
+  bool overflow_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+// Watches directory trees with inotify. Directories that are created or moved
+// into a watched tree are watched as well, but their contents are reported
+// only through the directory itself.
+class InotifyMonitor {
+public:
+  InotifyMonitor();
+  ~InotifyMonitor();
+
+  bool Add(const std::wstring& path);
+  void Clear();
+
+  // Waits for changes up to the timeout in milliseconds, and adds them to the
+  // queue. Returns false if nothing changed.
+  bool Read(FileChangeQueue& queue, int timeout);
+
+private:
+  bool AddWatch(const std::string& path, bool recursive);
+  void RenameWatches(const std::string& old_path, const std::string& new_path);
+  void RemoveWatches(const std::string& path);
+
+  int fd_;
+  std::map<int, std::string> watches_;  // Paths end with a slash
+  std::vector<char> buffer_;
+};
+
+#endif
+
+#endif  // TAIGA_BASE_FILE_CHANGE_QUEUE_H
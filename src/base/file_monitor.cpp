@@ -37,6 +37,7 @@ DirectoryChangeEntry::DirectoryChangeEntry(HANDLE directory_handle,
                                            const std::wstring& path)
     : bytes_returned_(0),
       directory_handle_(directory_handle),
+      overflow(false),
       path(path),
       state(kStateStopped) {
   buffer_.resize(65536);
@@ -160,13 +161,15 @@ void DirectoryMonitor::MonitorProc() {
   LPOVERLAPPED overlapped;
 
   do {
-    ::GetQueuedCompletionStatus(completion_port_,
-                                &number_of_bytes,
-                                reinterpret_cast<PULONG_PTR>(&entry),
-                                &overlapped,
-                                INFINITE);
-
-    if (entry && number_of_bytes > 0) {
+    // Entry isn't set if no packet is dequeued (e.g. the port was closed)
+    entry = nullptr;
+    overlapped = nullptr;
+    BOOL result = ::GetQueuedCompletionStatus(
+        completion_port_, &number_of_bytes,
+        reinterpret_cast<PULONG_PTR>(&entry), &overlapped, INFINITE);
+    DWORD error = result ? ERROR_SUCCESS : ::GetLastError();
+
+    if (entry) {
       win::Lock lock(critical_section_);
       switch (entry->state) {
         case DirectoryChangeEntry::kStateStopped: {
@@ -174,7 +177,15 @@ void DirectoryMonitor::MonitorProc() {
           break;
         }
         case DirectoryChangeEntry::kStateActive: {
-          HandleActiveState(*entry);
+          if (!result) {
+            HandleErrorState(*entry, error);
+          } else if (number_of_bytes > 0) {
+            HandleActiveState(*entry);
+          } else {
+            // A successful read of zero bytes means that the buffer
+            // overflowed (ERROR_NOTIFY_ENUM_DIR)
+            HandleOverflowState(*entry);
+          }
           break;
         }
       }
@@ -215,7 +226,34 @@ void DirectoryMonitor::HandleActiveState(DirectoryChangeEntry& entry) {
   }
 
   // Continue monitoring
-  ReadDirectoryChanges(entry);
+  if (!ReadDirectoryChanges(entry))
+    HandleErrorState(entry, ::GetLastError());
+}
+
+void DirectoryMonitor::HandleOverflowState(DirectoryChangeEntry& entry) {
+  entry.notifications.clear();
+  entry.overflow = true;
+
+  LOG(LevelDebug, L"Buffer overflowed: " + entry.path);
+
+  if (window_handle_) {
+    ::PostMessage(window_handle_, WM_MONITORCALLBACK, 0,
+                  reinterpret_cast<LPARAM>(&entry));
+  }
+
+  if (!ReadDirectoryChanges(entry))
+    HandleErrorState(entry, ::GetLastError());
+}
+
+// The directory can't be monitored anymore (e.g. it was deleted, or the
+// network share it's on was disconnected). Monitoring stays stopped until the
+// monitor is started again, so that we don't keep failing in a loop.
+void DirectoryMonitor::HandleErrorState(DirectoryChangeEntry& entry,
+                                        DWORD error) {
+  entry.state = DirectoryChangeEntry::kStateStopped;
+
+  LOG(LevelError, L"Stopped monitoring: " + entry.path + L"\n" +
+                  Logger::FormatError(error));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -242,6 +280,13 @@ static void LogFileAction(const DirectoryChangeEntry& entry,
 void DirectoryMonitor::Callback(DirectoryChangeEntry& entry) {
   win::Lock lock(critical_section_);
 
+  if (entry.overflow) {
+    entry.overflow = false;
+    entry.notifications.clear();
+    HandleOverflow(entry.path);
+    return;
+  }
+
   DirectoryChangeNotification* old_name_notification = nullptr;
 
   for (auto& notification : entry.notifications) {
@@ -57,6 +57,7 @@ public:
   DirectoryChangeEntry(HANDLE directory_handle, const std::wstring& path);
 
   std::vector<DirectoryChangeNotification> notifications;
+  bool overflow;  // Notifications were lost
   std::wstring path;
   State state;
 
@@ -80,9 +81,10 @@ public:
   void Callback(DirectoryChangeEntry& entry);
   void SetWindowHandle(HWND hwnd);
 
-  // Override this function to handle notifications
+  // Override these functions to handle notifications
   virtual void HandleChangeNotification(
-      const DirectoryChangeNotification& notification) const = 0;
+      const DirectoryChangeNotification& notification) = 0;
+  virtual void HandleOverflow(const std::wstring& path) = 0;
 
 protected:
   bool Add(const std::wstring& path);
@@ -96,6 +98,8 @@ private:
   void MonitorProc();
   void HandleStoppedState(DirectoryChangeEntry& entry);
   void HandleActiveState(DirectoryChangeEntry& entry);
+  void HandleOverflowState(DirectoryChangeEntry& entry);
+  void HandleErrorState(DirectoryChangeEntry& entry, DWORD error);
 
   class Thread : public win::Thread {
   public:
@@ -17,11 +17,13 @@
 */
 
 #include "file.h"
+#include "file_walker.h"
 #include "log.h"
 #include "string.h"
 
 FileSearchHelper::FileSearchHelper()
-    : minimum_file_size_(0),
+    : directory_cache_(nullptr),
+      minimum_file_size_(0),
       skip_directories_(false),
       skip_files_(false),
       skip_subdirectories_(false) {
@@ -30,9 +32,11 @@ FileSearchHelper::FileSearchHelper()
 bool FileSearchHelper::Search(const std::wstring& root) {
   using namespace std::placeholders;
 
-  return Search(root,
+  bool stopped = Search(root,
       std::bind(&FileSearchHelper::OnDirectory, this, _1, _2, _3),
       std::bind(&FileSearchHelper::OnFile, this, _1, _2, _3));
+
+  return OnSearchEnd(stopped);
 }
 
 bool FileSearchHelper::Search(const std::wstring& root,
@@ -43,48 +47,47 @@ bool FileSearchHelper::Search(const std::wstring& root,
   if (skip_directories_ && skip_files_)
     return false;
 
-  std::wstring path = AddTrailingSlash(GetExtendedLengthPath(root)) + L"*";
-  bool result = false;
-
-  WIN32_FIND_DATA data;
-  HANDLE handle = FindFirstFile(path.c_str(), &data);
-
-  do {
-    if (handle == INVALID_HANDLE_VALUE) {
-      LOG(LevelError, Logger::FormatError(GetLastError()) + L"\nPath: " + path);
-      SetLastError(ERROR_SUCCESS);
-      continue;
-    }
+  auto OnEntry = [&](const std::wstring& path,
+                     const DirectoryWalker::Entry& entry)
+      -> DirectoryWalker::Action {
+    const WIN32_FIND_DATA& data = entry.data;
 
     if (IsSystemFile(data) || IsHiddenFile(data))
-      continue;
+      return DirectoryWalker::kContinue;
 
     // Directory
     if (IsDirectory(data)) {
       if (skip_directories_)
-        continue;
+        return DirectoryWalker::kContinue;
       if (!IsValidDirectory(data))
-        continue;
-      if (OnDirectoryFunc)
-        result = OnDirectoryFunc(root, data.cFileName, data);
-      if (!skip_subdirectories_ && !result)
-        result = Search(AddTrailingSlash(root) + data.cFileName,
-                        OnDirectoryFunc, OnFileFunc);
+        return DirectoryWalker::kContinue;
+      if (OnDirectoryFunc && OnDirectoryFunc(path, data.cFileName, data))
+        return DirectoryWalker::kStop;
+      return skip_subdirectories_ ? DirectoryWalker::kContinue :
+                                    DirectoryWalker::kDescend;
 
     // File
     } else {
       if (skip_files_)
-        continue;
+        return DirectoryWalker::kContinue;
       if (data.nFileSizeLow < minimum_file_size_)
-        continue;
-      if (OnFileFunc)
-        result = OnFileFunc(root, std::wstring(data.cFileName), data);
+        return DirectoryWalker::kContinue;
+      if (OnFileFunc && OnFileFunc(path, std::wstring(data.cFileName), data))
+        return DirectoryWalker::kStop;
+      return DirectoryWalker::kContinue;
     }
+  };
+
+  auto OnError = [](const std::wstring& path, unsigned long error) {
+    LOG(LevelError, Logger::FormatError(error) + L"\nPath: " + path);
+  };
 
-  } while (!result && FindNextFile(handle, &data));
+  // Subdirectories are read ahead only if we're going to walk them
+  bool recursive = !skip_directories_ && !skip_subdirectories_;
 
-  FindClose(handle);
-  return result;
+  DirectoryWalker walker;
+  walker.set_cache(directory_cache_);
+  return walker.Walk(root, recursive, OnEntry, OnError);
 }
 
 bool FileSearchHelper::OnDirectory(const std::wstring& root,
@@ -99,6 +102,14 @@ bool FileSearchHelper::OnFile(const std::wstring& root,
   return false;
 }
 
+bool FileSearchHelper::OnSearchEnd(bool stopped) {
+  return stopped;
+}
+
+void FileSearchHelper::set_directory_cache(DirectoryCache* directory_cache) {
+  directory_cache_ = directory_cache;
+}
+
 void FileSearchHelper::set_skip_directories(bool skip_directories) {
   skip_directories_ = skip_directories;
 }
@@ -0,0 +1,393 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "file_walker.h"
+
+#ifdef _WIN32
+#include "file.h"
+#include "string.h"
+#else
+#include <codecvt>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale>
+#include <stdexcept>
+#include <sys/stat.h>
+#endif
+
+DirectoryWalker::DirectoryWalker(size_t thread_count,
+                                 size_t max_pending_directories)
+    : cache_(nullptr),
+      thread_count_(thread_count),
+      max_pending_directories_(max_pending_directories),
+      recursive_(false),
+      pending_count_(0),
+      stop_(false) {
+}
+
+void DirectoryWalker::set_cache(DirectoryCache* cache) {
+  cache_ = cache;
+}
+
+bool DirectoryWalker::Walk(const std::wstring& root, bool recursive,
+                           entry_callback_t OnEntry, error_callback_t OnError) {
+  if (root.empty() || !OnEntry)
+    return false;
+
+  recursive_ = recursive && thread_count_ > 0;
+  OnEntry_ = OnEntry;
+  OnError_ = OnError;
+  pending_count_ = 0;
+  stop_ = false;
+
+  if (recursive_) {
+    queues_.resize(thread_count_);
+    for (size_t i = 0; i < thread_count_; i++)
+      threads_.push_back(std::thread(&DirectoryWalker::ReadThreadProc, this, i));
+  }
+
+  Listing listing;
+  GetListing(root, listing);
+  bool result = WalkDirectory(root, listing);
+
+  if (recursive_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_available_.notify_all();
+    for (auto it = threads_.begin(); it != threads_.end(); ++it)
+      it->join();
+    threads_.clear();
+    queues_.clear();
+    listings_.clear();
+  }
+
+  OnEntry_ = nullptr;
+  OnError_ = nullptr;
+
+  return result;
+}
+
+bool DirectoryWalker::WalkDirectory(const std::wstring& path,
+                                    Listing& listing) {
+  if (listing.error && OnError_)
+    OnError_(path, listing.error);
+
+  for (auto it = listing.entries.begin(); it != listing.entries.end(); ++it) {
+    Action action = OnEntry_(path, *it);
+    if (action == kStop)
+      return true;
+    if (!it->directory)
+      continue;
+
+    std::wstring subdirectory = JoinPath(path, it->name);
+    if (action == kDescend) {
+      Listing sublisting;
+      GetListing(subdirectory, sublisting);
+      if (WalkDirectory(subdirectory, sublisting))
+        return true;
+    } else {
+      ReleaseListing(subdirectory);
+    }
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void DirectoryWalker::GetListing(const std::wstring& path, Listing& listing) {
+  if (recursive_) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = listings_.find(path);
+    if (it != listings_.end()) {
+      if (it->second.state == kQueued) {
+        // Not worth waiting for, threads skip directories that are no longer
+        // listed
+        listings_.erase(it);
+      } else {
+        listing_read_.wait(lock, [&]() { return it->second.state == kRead; });
+        listing.entries.swap(it->second.listing.entries);
+        listing.error = it->second.listing.error;
+        listings_.erase(it);
+        pending_count_--;
+        work_available_.notify_all();
+        return;
+      }
+    }
+  }
+
+  ReadListing(path, listing);
+
+  if (recursive_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScheduleSubdirectories(path, listing, 0);
+  }
+}
+
+void DirectoryWalker::ReleaseListing(const std::wstring& path) {
+  if (!recursive_)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Subdirectories of a listing that was read are queued as well
+  std::vector<std::wstring> paths(1, path);
+  while (!paths.empty()) {
+    std::wstring current_path = paths.back();
+    paths.pop_back();
+    auto it = listings_.find(current_path);
+    if (it == listings_.end())
+      continue;
+    switch (it->second.state) {
+      case kQueued:
+        listings_.erase(it);
+        break;
+      case kReading:
+        it->second.state = kReleased;
+        break;
+      case kRead: {
+        const auto& entries = it->second.listing.entries;
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+          if (entry->directory && !entry->hidden)
+            paths.push_back(JoinPath(current_path, entry->name));
+        listings_.erase(it);
+        pending_count_--;
+        work_available_.notify_all();
+        break;
+      }
+      case kReleased:
+        break;
+    }
+  }
+}
+
+// Must be called while the mutex is locked
+void DirectoryWalker::ScheduleSubdirectories(const std::wstring& path,
+                                             const Listing& listing,
+                                             size_t queue_index) {
+  if (stop_)
+    return;
+
+  // Pushed in reverse, so that the first subdirectory is taken first
+  auto& queue = queues_.at(queue_index);
+  bool scheduled = false;
+  for (auto it = listing.entries.rbegin(); it != listing.entries.rend(); ++it) {
+    if (!it->directory || it->hidden)
+      continue;
+    std::wstring subdirectory = JoinPath(path, it->name);
+    listings_[subdirectory].state = kQueued;
+    queue.push_back(subdirectory);
+    scheduled = true;
+  }
+
+  if (scheduled)
+    work_available_.notify_all();
+}
+
+void DirectoryWalker::ReadThreadProc(size_t queue_index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    std::wstring path;
+    work_available_.wait(lock, [&]() {
+      return stop_ || (pending_count_ < max_pending_directories_ &&
+                       StealWork(queue_index, path));
+    });
+    if (stop_)
+      return;
+
+    auto it = listings_.find(path);
+    if (it == listings_.end() || it->second.state != kQueued)
+      continue;
+    it->second.state = kReading;
+    pending_count_++;
+
+    lock.unlock();
+    Listing listing;
+    ReadListing(path, listing);
+    lock.lock();
+
+    if (stop_)
+      return;
+
+    if (it->second.state == kReleased) {
+      listings_.erase(it);
+      pending_count_--;
+      continue;
+    }
+
+    it->second.listing.entries.swap(listing.entries);
+    it->second.listing.error = listing.error;
+    it->second.state = kRead;
+    listing_read_.notify_all();
+
+    ScheduleSubdirectories(path, it->second.listing, queue_index);
+  }
+}
+
+void DirectoryWalker::ReadListing(const std::wstring& path, Listing& listing) {
+  unsigned long long stamp = 0;
+
+  if (cache_ && cache_->Find(path, listing.entries, stamp)) {
+    listing.error = 0;
+    return;
+  }
+
+  ReadDirectory(path, listing);
+
+  if (cache_ && !listing.error)
+    cache_->Store(path, stamp, listing.entries);
+}
+
+// Must be called while the mutex is locked
+bool DirectoryWalker::StealWork(size_t queue_index, std::wstring& path) {
+  auto& own_queue = queues_.at(queue_index);
+  if (!own_queue.empty()) {
+    path = own_queue.back();
+    own_queue.pop_back();
+    return true;
+  }
+
+  for (size_t i = 1; i < queues_.size(); i++) {
+    auto& queue = queues_.at((queue_index + i) % queues_.size());
+    if (!queue.empty()) {
+      path = queue.front();
+      queue.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+
+std::wstring DirectoryWalker::JoinPath(const std::wstring& root,
+                                       const std::wstring& name) {
+  return AddTrailingSlash(root) + name;
+}
+
+void DirectoryWalker::ReadDirectory(const std::wstring& path,
+                                    Listing& listing) {
+  listing.entries.clear();
+  listing.error = ERROR_SUCCESS;
+
+  std::wstring pattern = AddTrailingSlash(GetExtendedLengthPath(path)) + L"*";
+
+  WIN32_FIND_DATA data;
+  HANDLE handle = FindFirstFile(pattern.c_str(), &data);
+
+  if (handle == INVALID_HANDLE_VALUE) {
+    listing.error = GetLastError();
+    return;
+  }
+
+  do {
+    if (wcscmp(data.cFileName, L".") == 0 ||
+        wcscmp(data.cFileName, L"..") == 0)
+      continue;
+
+    Entry entry;
+    entry.name = data.cFileName;
+    entry.directory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    entry.hidden = (data.dwFileAttributes &
+                    (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) != 0;
+    entry.size = (static_cast<unsigned long long>(data.nFileSizeHigh) << 32) |
+                 data.nFileSizeLow;
+    entry.data = data;
+    listing.entries.push_back(entry);
+  } while (FindNextFile(handle, &data));
+
+  FindClose(handle);
+}
+
+#else
+
+std::wstring DirectoryWalker::JoinPath(const std::wstring& root,
+                                       const std::wstring& name) {
+  if (!root.empty() && root.back() != L'/')
+    return root + L'/' + name;
+  return root + name;
+}
+
+// readdir is a buffered wrapper around getdents
+void DirectoryWalker::ReadDirectory(const std::wstring& path,
+                                    Listing& listing) {
+  listing.entries.clear();
+  listing.error = 0;
+
+  std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+  std::string native_path;
+  try {
+    native_path = converter.to_bytes(path);
+  } catch (const std::range_error&) {
+    listing.error = EINVAL;
+    return;
+  }
+
+  DIR* dir = opendir(native_path.c_str());
+  if (!dir) {
+    listing.error = errno;
+    return;
+  }
+
+  while (dirent* dir_entry = readdir(dir)) {
+    const char* name = dir_entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+
+    Entry entry;
+    try {
+      entry.name = converter.from_bytes(name);
+    } catch (const std::range_error&) {
+      continue;
+    }
+    entry.directory = dir_entry->d_type == DT_DIR;
+    entry.hidden = name[0] == '.';
+    entry.size = 0;
+
+    // Symbolic links are followed to files only, so that a walk can't loop
+    if (!entry.directory) {
+      struct stat file_stat;
+      if (fstatat(dirfd(dir), name, &file_stat, 0) != 0)
+        continue;
+      if (S_ISDIR(file_stat.st_mode)) {
+        if (dir_entry->d_type != DT_UNKNOWN)
+          continue;
+        if (fstatat(dirfd(dir), name, &file_stat, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISDIR(file_stat.st_mode))
+          continue;
+        entry.directory = true;
+      } else {
+        entry.size = static_cast<unsigned long long>(file_stat.st_size);
+      }
+    }
+
+    listing.entries.push_back(entry);
+  }
+
+  closedir(dir);
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_BASE_FILE_WALKER_H
+#define TAIGA_BASE_FILE_WALKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Walks directory trees depth-first. Entries are passed to the callback on the
+// calling thread, in the same order a recursive FindFirstFile/FindNextFile
+// search would visit them. Meanwhile, a pool of threads reads the directories
+// that are likely to be visited next, which hides the latency of slow drives
+// and network shares.
+//
+// This file does not depend on the rest of the application, so that it can be
+// built on other platforms.
+
+class DirectoryCache;
+
+class DirectoryWalker {
+public:
+  enum Action {
+    kContinue,  // Go on with the next entry
+    kDescend,   // Walk the directory, then go on with the next entry
+    kStop       // End the walk
+  };
+
+  struct Entry {
+    std::wstring name;
+    bool directory;
+    bool hidden;  // Hidden and system entries
+    unsigned long long size;
+#ifdef _WIN32
+    WIN32_FIND_DATA data;
+#endif
+  };
+
+  typedef std::function<Action(const std::wstring& root, const Entry& entry)> entry_callback_t;
+  typedef std::function<void(const std::wstring& path, unsigned long error)> error_callback_t;
+
+  DirectoryWalker(size_t thread_count = 4, size_t max_pending_directories = 256);
+  ~DirectoryWalker() {}
+
+  void set_cache(DirectoryCache* cache);
+
+  // Returns true if the callback stopped the walk. Directories are read ahead
+  // only for recursive walks.
+  bool Walk(const std::wstring& root, bool recursive,
+            entry_callback_t OnEntry, error_callback_t OnError = nullptr);
+
+private:
+  struct Listing {
+    std::vector<Entry> entries;
+    unsigned long error;
+  };
+
+  enum ListingState {
+    kQueued,
+    kReading,
+    kRead,
+    kReleased
+  };
+
+  struct PendingListing {
+    ListingState state;
+    Listing listing;
+  };
+
+  bool WalkDirectory(const std::wstring& path, Listing& listing);
+
+  void GetListing(const std::wstring& path, Listing& listing);
+  void ReleaseListing(const std::wstring& path);
+  void ScheduleSubdirectories(const std::wstring& path, const Listing& listing, size_t queue_index);
+  void ReadThreadProc(size_t queue_index);
+  bool StealWork(size_t queue_index, std::wstring& path);
+
+  void ReadListing(const std::wstring& path, Listing& listing);
+
+  static std::wstring JoinPath(const std::wstring& root, const std::wstring& name);
+  static void ReadDirectory(const std::wstring& path, Listing& listing);
+
+  DirectoryCache* cache_;
+  size_t thread_count_;
+  size_t max_pending_directories_;
+  bool recursive_;
+  entry_callback_t OnEntry_;
+  error_callback_t OnError_;
+
+  // Each thread takes the last directory of its own queue, and steals the
+  // first directory of another queue once its own is empty
+  std::vector<std::deque<std::wstring>> queues_;
+  std::map<std::wstring, PendingListing> listings_;
+  size_t pending_count_;  // Listings that are being read or waiting
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable listing_read_;
+  std::condition_variable work_available_;
+  std::vector<std::thread> threads_;
+};
+
+// Provides the listings of directories that haven't changed since they were
+// last read. Must be safe to call from multiple threads.
+class DirectoryCache {
+public:
+  virtual ~DirectoryCache() {}
+
+  // Returns false if the directory has to be read. In that case, stamp
+  // identifies the current state of the directory, and is passed to Store
+  // along with the entries that are read.
+  virtual bool Find(const std::wstring& path,
+                    std::vector<DirectoryWalker::Entry>& entries,
+                    unsigned long long& stamp) = 0;
+  virtual void Store(const std::wstring& path, unsigned long long stamp,
+                     const std::vector<DirectoryWalker::Entry>& entries) = 0;
+};
+
+#endif  // TAIGA_BASE_FILE_WALKER_H
@@ -17,7 +17,9 @@
 */
 
 #include <algorithm>
+#include <emmintrin.h>
 #include <functional>
+#include <intrin.h>
 #include <iomanip>
 #include <locale>
 #include <map>
@@ -267,58 +269,298 @@ std::wstring FirstMatchRegex(const wstring& str, const wstring& pattern) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+// Case-insensitive search
+
+namespace {
+
+// Folds the same characters as IsCharsEqual, which compares them with tolower
+// in the "C" locale
+inline wchar_t FoldChar(wchar_t c) {
+  return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : c;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+static_assert(sizeof(wchar_t) == 2, "Characters are compared 8 at a time");
+
+const size_t kCharsPerVector = 8;
+
+inline __m128i FoldChars(__m128i chars) {
+  // Characters above 0x7FFF are negative here, which is fine since they're not
+  // in range anyway
+  __m128i is_upper = _mm_and_si128(
+      _mm_cmpgt_epi16(chars, _mm_set1_epi16(L'A' - 1)),
+      _mm_cmplt_epi16(chars, _mm_set1_epi16(L'Z' + 1)));
+  return _mm_or_si128(
+      chars, _mm_and_si128(is_upper, _mm_set1_epi16(L'a' - L'A')));
+}
+#endif
+
+// Returns the first position in str where the folded search string occurs,
+// starting from pos. Candidates are found by comparing the first and last
+// characters of the search string at 8 positions at a time.
+template <bool folded>
+size_t FindFoldedString(const wchar_t* str, size_t length, size_t pos,
+                        const wchar_t* search, size_t search_length) {
+  if (length < search_length || pos > length - search_length)
+    return wstring::npos;
+
+  auto fold = [](wchar_t c) { return folded ? c : FoldChar(c); };
+  auto matches_at = [&](size_t i) {
+    for (size_t j = 1; j + 1 < search_length; j++)
+      if (fold(str[i + j]) != search[j])
+        return false;
+    return true;
+  };
+
+  const size_t last_pos = length - search_length;
+  size_t i = pos;
+
+#if defined(_M_IX86) || defined(_M_X64)
+  const __m128i first_char = _mm_set1_epi16(search[0]);
+  const __m128i last_char = _mm_set1_epi16(search[search_length - 1]);
+
+  for ( ; i + kCharsPerVector <= last_pos + 1; i += kCharsPerVector) {
+    __m128i first_block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(str + i));
+    __m128i last_block = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(str + i + search_length - 1));
+    if (!folded) {
+      first_block = FoldChars(first_block);
+      last_block = FoldChars(last_block);
+    }
 
-size_t LongestCommonSubsequenceLength(const wstring& str1,
-                                      const wstring& str2) {
-  if (str1.empty() || str2.empty())
+    // Two bits are set for each candidate position
+    unsigned long mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi16(first_block, first_char),
+        _mm_cmpeq_epi16(last_block, last_char)));
+
+    while (mask) {
+      unsigned long bit = 0;
+      _BitScanForward(&bit, mask);
+      if (matches_at(i + bit / 2))
+        return i + bit / 2;
+      mask &= ~(3UL << bit);
+    }
+  }
+#endif
+
+  for ( ; i <= last_pos; i++)
+    if (fold(str[i]) == search[0] &&
+        fold(str[i + search_length - 1]) == search[search_length - 1] &&
+        matches_at(i))
+      return i;
+
+  return wstring::npos;
+}
+
+}  // namespace
+
+CaseInsensitiveSearcher::CaseInsensitiveSearcher(const wstring& str) {
+  Compile(str);
+}
+
+void CaseInsensitiveSearcher::Compile(const wstring& str) {
+  str_ = str;
+  FoldCase(str_);
+}
+
+int CaseInsensitiveSearcher::Find(const wstring& str, int pos) const {
+  // Same special cases as InStr
+  if (str.empty())
+    return -1;
+  if (str_.empty())
     return 0;
 
-  const size_t len1 = str1.length();
-  const size_t len2 = str2.length();
+  size_t i = FindFoldedString<false>(str.data(), str.size(), pos,
+                                     str_.data(), str_.size());
+  return i != wstring::npos ? static_cast<int>(i) : -1;
+}
 
-  vector<vector<size_t>> table(len1 + 1);
-  for (auto it = table.begin(); it != table.end(); ++it)
-    it->resize(len2 + 1);
+int CaseInsensitiveSearcher::FindFolded(const wstring& str, int pos) const {
+  if (str.empty())
+    return -1;
+  if (str_.empty())
+    return 0;
 
-  for (size_t i = 0; i < len1; i++) {
-    for (size_t j = 0; j < len2; j++) {
-      if (str1[i] == str2[j]) {
-        table[i + 1][j + 1] = table[i][j] + 1;
+  size_t i = FindFoldedString<true>(str.data(), str.size(), pos,
+                                    str_.data(), str_.size());
+  return i != wstring::npos ? static_cast<int>(i) : -1;
+}
+
+const wstring& CaseInsensitiveSearcher::str() const {
+  return str_;
+}
+
+void CaseInsensitiveSearcher::FoldCase(wstring& str) {
+  for (size_t i = 0; i < str.size(); i++)
+    str[i] = FoldChar(str[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Similarity functions are computed with bit-parallel algorithms, where each
+// bit of a vector stands for a character of one of the strings. Strings that
+// are longer than 64 characters are split into blocks of 64.
+
+namespace {
+
+const size_t kBitsPerBlock = 64;
+
+size_t CountBits(UINT64 value) {
+  value = value - ((value >> 1) & 0x5555555555555555ULL);
+  value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+  value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<size_t>((value * 0x0101010101010101ULL) >> 56);
+}
+
+size_t CountTrailingZeros(UINT64 value) {
+  unsigned long index = 0;
+  if (_BitScanForward(&index, static_cast<unsigned long>(value)))
+    return index;
+  _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+  return index + 32;
+}
+
+// Maps each character to a bit mask of its positions in a string. Characters
+// below 256 are looked up directly, and the rest are searched linearly, as
+// there are only a few of them in a title.
+class MatchMasks {
+public:
+  MatchMasks(const wstring& str, StringSimilarityBuffer& buffer)
+      : str_(str), buffer_(buffer),
+        blocks_((str.size() + kBitsPerBlock - 1) / kBitsPerBlock) {
+    if (buffer_.masks.size() < 256 * blocks_)
+      buffer_.masks.resize(256 * blocks_);
+    buffer_.extended_chars.clear();
+    buffer_.extended_masks.assign(blocks_, 0);  // Masks of absent characters
+
+    for (size_t i = 0; i < str.size(); ++i) {
+      const wchar_t c = str[i];
+      UINT64* masks = nullptr;
+      if (c < 256) {
+        masks = &buffer_.masks[c * blocks_];
       } else {
-        table[i + 1][j + 1] = max(table[i + 1][j], table[i][j + 1]);
+        auto it = std::find_if(buffer_.extended_chars.begin(),
+                               buffer_.extended_chars.end(),
+            [&c](const std::pair<wchar_t, size_t>& pair) {
+              return pair.first == c;
+            });
+        if (it == buffer_.extended_chars.end()) {
+          buffer_.extended_chars.push_back(
+              std::make_pair(c, buffer_.extended_masks.size()));
+          buffer_.extended_masks.resize(buffer_.extended_masks.size() + blocks_);
+          it = buffer_.extended_chars.end() - 1;
+        }
+        masks = &buffer_.extended_masks[it->second];
       }
+      masks[i / kBitsPerBlock] |= 1ULL << (i % kBitsPerBlock);
     }
   }
 
-  return table.back().back();
+  ~MatchMasks() {
+    for (size_t i = 0; i < str_.size(); ++i)
+      if (str_[i] < 256)
+        buffer_.masks[str_[i] * blocks_ + i / kBitsPerBlock] = 0;
+  }
+
+  size_t blocks() const {
+    return blocks_;
+  }
+
+  const UINT64* Get(wchar_t c) const {
+    if (c < 256)
+      return &buffer_.masks[c * blocks_];
+    for (const auto& pair : buffer_.extended_chars)
+      if (pair.first == c)
+        return &buffer_.extended_masks[pair.second];
+    return &buffer_.extended_masks[0];
+  }
+
+private:
+  const wstring& str_;
+  StringSimilarityBuffer& buffer_;
+  const size_t blocks_;
+};
+
+}  // namespace
+
+size_t LongestCommonSubsequenceLength(const wstring& str1,
+                                      const wstring& str2) {
+  StringSimilarityBuffer buffer;
+  return LongestCommonSubsequenceLength(str1, str2, buffer);
+}
+
+// Based on Hyyrö's bit-parallel LCS algorithm, where zero bits of the vector
+// stand for the characters of the shorter string that are in the subsequence
+size_t LongestCommonSubsequenceLength(const wstring& str1,
+                                      const wstring& str2,
+                                      StringSimilarityBuffer& buffer) {
+  if (str1.empty() || str2.empty())
+    return 0;
+
+  const wstring& pattern = str1.size() <= str2.size() ? str1 : str2;
+  const wstring& text = str1.size() <= str2.size() ? str2 : str1;
+
+  const MatchMasks match_masks(pattern, buffer);
+  const size_t blocks = match_masks.blocks();
+  auto& vectors = buffer.vectors;
+  vectors.assign(blocks, ~0ULL);
+
+  for (size_t i = 0; i < text.size(); ++i) {
+    const UINT64* masks = match_masks.Get(text[i]);
+    UINT64 carry = 0;
+    for (size_t block = 0; block < blocks; ++block) {
+      const UINT64 v = vectors[block];
+      const UINT64 u = v & masks[block];
+      const UINT64 sum = v + carry;
+      carry = sum < carry;
+      const UINT64 x = sum + u;
+      carry |= x < u;
+      vectors[block] = x | (v - u);
+    }
+  }
+
+  size_t length = 0;
+  for (size_t block = 0; block < blocks; ++block) {
+    UINT64 v = ~vectors[block];
+    const size_t bits = pattern.size() - block * kBitsPerBlock;
+    if (bits < kBitsPerBlock)
+      v &= (1ULL << bits) - 1;
+    length += CountBits(v);
+  }
+
+  return length;
 }
 
 size_t LongestCommonSubstringLength(const wstring& str1, const wstring& str2) {
+  StringSimilarityBuffer buffer;
+  return LongestCommonSubstringLength(str1, str2, buffer);
+}
+
+size_t LongestCommonSubstringLength(const wstring& str1, const wstring& str2,
+                                    StringSimilarityBuffer& buffer) {
   if (str1.empty() || str2.empty())
     return 0;
 
   const size_t len1 = str1.length();
   const size_t len2 = str2.length();
 
-  vector<vector<size_t>> table(len1);
-  for (auto it = table.begin(); it != table.end(); ++it)
-    it->resize(len2);
+  // Only the previous row of the table is needed. It is updated from right to
+  // left, so that row[j] still belongs to the previous row when it is read.
+  auto& row = buffer.row;
+  row.assign(len2 + 1, 0);
 
   size_t longest_length = 0;
 
   for (size_t i = 0; i < len1; i++) {
-    for (size_t j = 0; j < len2; j++) {
-      if (str1[i] == str2[j]) {
-        if (i == 0 || j == 0) {
-          table[i][j] = 1;
-        } else {
-          table[i][j] = table[i - 1][j - 1] + 1;
-        }
-        if (table[i][j] > longest_length) {
-          longest_length = table[i][j];
+    for (size_t j = len2; j > 0; j--) {
+      if (str1[i] == str2[j - 1]) {
+        row[j] = row[j - 1] + 1;
+        if (row[j] > longest_length) {
+          longest_length = row[j];
         }
       } else {
-        table[i][j] = 0;
+        row[j] = 0;
       }
     }
   }
@@ -328,26 +570,51 @@ size_t LongestCommonSubstringLength(const wstring& str1, const wstring& str2) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+double JaroWinklerDistance(const wstring& str1, const wstring& str2) {
+  StringSimilarityBuffer buffer;
+  return JaroWinklerDistance(str1, str2, buffer);
+}
+
 // Based on Miguel Serrano's Jaro-Winkler distance implementation
 // Licensed under GNU GPLv3 - Copyright (C) 2011 Miguel Serrano
-double JaroWinklerDistance(const wstring& str1, const wstring& str2) {
+double JaroWinklerDistance(const wstring& str1, const wstring& str2,
+                           StringSimilarityBuffer& buffer) {
   const int len1 = str1.size();
   const int len2 = str2.size();
 
   if (!len1 || !len2)
     return 0.0;
 
-  int i, j, l;
+  int i, l;
   int m = 0, t = 0;
-  vector<int> sflags(len1), aflags(len2);
 
-  // Calculate matching characters
+  // Calculate matching characters. Each character of str2 is matched with the
+  // first unmatched one of str1 within range, which is found from the bits of
+  // its match mask.
+  const MatchMasks match_masks(str1, buffer);
+  auto& sflags = buffer.vectors;
+  sflags.assign(match_masks.blocks(), 0);
+  auto& matches = buffer.chars;  // Matched characters of str2, in order
+  matches.clear();
+
   int range = max(0, (max(len1, len2) / 2) - 1);
   for (i = 0; i < len2; i++) {
-    for (j = max(i - range, 0), l = min(i + range + 1, len1); j < l; j++) {
-      if (str2[i] == str1[j] && !sflags[j]) {
-        sflags[j] = 1;
-        aflags[i] = 1;
+    const size_t begin = static_cast<size_t>(max(i - range, 0));
+    const size_t end = static_cast<size_t>(min(i + range + 1, len1));
+    if (begin >= end)
+      continue;
+    const UINT64* masks = match_masks.Get(str2[i]);
+    for (size_t block = begin / kBitsPerBlock;
+         block <= (end - 1) / kBitsPerBlock; block++) {
+      const size_t offset = block * kBitsPerBlock;
+      UINT64 candidates = masks[block] & ~sflags[block];
+      if (begin > offset)
+        candidates &= ~0ULL << (begin - offset);
+      if (end - offset < kBitsPerBlock)
+        candidates &= (1ULL << (end - offset)) - 1;
+      if (candidates) {
+        sflags[block] |= candidates & (0 - candidates);
+        matches.push_back(str2[i]);
         m++;
         break;
       }
@@ -357,16 +624,11 @@ double JaroWinklerDistance(const wstring& str1, const wstring& str2) {
     return 0.0;
 
   // Calculate character transpositions
-  l = 0;
-  for (i = 0; i < len2; i++) {
-    if (aflags[i] == 1) {
-      for (j = l; j < len1; j++) {
-        if (sflags[j] == 1) {
-          l = j + 1;
-          break;
-        }
-      }
-      if (str2[i] != str1[j])
+  size_t k = 0;
+  for (size_t block = 0; block < sflags.size(); block++) {
+    for (UINT64 flags = sflags[block]; flags; flags &= flags - 1) {
+      const size_t j = block * kBitsPerBlock + CountTrailingZeros(flags);
+      if (matches[k++] != str1[j])
         t++;
     }
   }
@@ -391,27 +653,61 @@ double JaroWinklerDistance(const wstring& str1, const wstring& str2) {
 }
 
 double LevenshteinDistance(const wstring& str1, const wstring& str2) {
-  const size_t len1 = str1.size();
-  const size_t len2 = str2.size();
-
-  vector<size_t> prev_col(len2 + 1);
-  for (size_t i = 0; i < prev_col.size(); i++)
-    prev_col[i] = i;
-
-  vector<size_t> col(len2 + 1);
-
-  for (size_t i = 0; i < len1; i++) {
-    col[0] = i + 1;
-
-    for (size_t j = 0; j < len2; j++)
-      col[j + 1] = min(min(1 + col[j], 1 + prev_col[1 + j]),
-                       prev_col[j] + (str1[i] == str2[j] ? 0 : 1));
-
-    col.swap(prev_col);
+  StringSimilarityBuffer buffer;
+  return LevenshteinDistance(str1, str2, buffer);
+}
+
+// Based on Hyyrö's block-based version of Myers' bit-parallel algorithm, where
+// the vectors hold the vertical differences of a column of the table
+double LevenshteinDistance(const wstring& str1, const wstring& str2,
+                           StringSimilarityBuffer& buffer) {
+  const wstring& pattern = str1.size() <= str2.size() ? str1 : str2;
+  const wstring& text = str1.size() <= str2.size() ? str2 : str1;
+
+  size_t distance = text.size();
+
+  if (!pattern.empty()) {
+    const MatchMasks match_masks(pattern, buffer);
+    const size_t blocks = match_masks.blocks();
+    const UINT64 last = 1ULL << ((pattern.size() - 1) % kBitsPerBlock);
+    auto& vectors = buffer.vectors;  // Positive and negative differences
+    vectors.resize(blocks * 2);
+    std::fill(vectors.begin(), vectors.begin() + blocks, ~0ULL);
+    std::fill(vectors.begin() + blocks, vectors.end(), 0);
+    distance = pattern.size();
+
+    for (size_t i = 0; i < text.size(); ++i) {
+      const UINT64* masks = match_masks.Get(text[i]);
+      UINT64 hp_carry = 1;
+      UINT64 hn_carry = 0;
+      for (size_t block = 0; block < blocks; ++block) {
+        UINT64& vp = vectors[block];
+        UINT64& vn = vectors[blocks + block];
+        const UINT64 x = masks[block] | hn_carry;
+        const UINT64 d0 = (((x & vp) + vp) ^ vp) | x | vn;
+        UINT64 hp = vn | ~(d0 | vp);
+        UINT64 hn = d0 & vp;
+        const UINT64 hp_carry_in = hp_carry;
+        const UINT64 hn_carry_in = hn_carry;
+        if (block < blocks - 1) {
+          hp_carry = hp >> 63;
+          hn_carry = hn >> 63;
+        } else {
+          if (hp & last)
+            distance++;
+          if (hn & last)
+            distance--;
+        }
+        hp = (hp << 1) | hp_carry_in;
+        hn = (hn << 1) | hn_carry_in;
+        vp = hn | ~(d0 | hp);
+        vn = hp & d0;
+      }
+    }
   }
 
   const double len = static_cast<double>(max(str1.size(), str2.size()));
-  return 1.0 - (prev_col[len2] / len);
+  return 1.0 - (distance / len);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -58,10 +58,50 @@ bool MatchRegex(const std::wstring& str, const std::wstring& pattern);
 bool SearchRegex(const std::wstring& str, const std::wstring& pattern);
 std::wstring FirstMatchRegex(const std::wstring& str, const std::wstring& pattern);
 
+// Finds a string in others, ignoring case the same way InStr does. The search
+// string is folded once, and candidates are located several characters at a
+// time with SSE2.
+class CaseInsensitiveSearcher {
+public:
+  CaseInsensitiveSearcher() {}
+  explicit CaseInsensitiveSearcher(const std::wstring& str);
+
+  void Compile(const std::wstring& str);
+
+  // Returns the same as InStr(str, this->str(), pos, true)
+  int Find(const std::wstring& str, int pos = 0) const;
+  // Same as Find, for strings that were already folded with FoldCase
+  int FindFolded(const std::wstring& str, int pos = 0) const;
+
+  const std::wstring& str() const;
+
+  static void FoldCase(std::wstring& str);
+
+private:
+  std::wstring str_;
+};
+
+// Scratch space for the string similarity functions below, so that comparing
+// a string with many others doesn't allocate memory on every call. A buffer
+// must not be shared between threads.
+class StringSimilarityBuffer {
+public:
+  std::vector<UINT64> masks;  // Match masks of characters below 256, kept zeroed
+  std::vector<std::pair<wchar_t, size_t>> extended_chars;
+  std::vector<UINT64> extended_masks;
+  std::vector<UINT64> vectors;
+  std::vector<size_t> row;
+  std::vector<wchar_t> chars;
+};
+
 size_t LongestCommonSubsequenceLength(const std::wstring& str1, const std::wstring& str2);
+size_t LongestCommonSubsequenceLength(const std::wstring& str1, const std::wstring& str2, StringSimilarityBuffer& buffer);
 size_t LongestCommonSubstringLength(const std::wstring& str1, const std::wstring& str2);
+size_t LongestCommonSubstringLength(const std::wstring& str1, const std::wstring& str2, StringSimilarityBuffer& buffer);
 double JaroWinklerDistance(const std::wstring& str1, const std::wstring& str2);
+double JaroWinklerDistance(const std::wstring& str1, const std::wstring& str2, StringSimilarityBuffer& buffer);
 double LevenshteinDistance(const std::wstring& str1, const std::wstring& str2);
+double LevenshteinDistance(const std::wstring& str1, const std::wstring& str2, StringSimilarityBuffer& buffer);
 
 typedef std::array<wchar_t, 3> trigram_t;
 typedef std::vector<trigram_t> trigram_container_t;
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "base/time.h"
+#include "library/anime_availability.h"
 
 namespace anime {
 
@@ -105,7 +106,7 @@ class LocalInformation {
   virtual ~LocalInformation() {}
 
   int last_aired_episode;
-  std::vector<bool> available_episodes;
+  AvailableEpisodes available_episodes;
   std::wstring next_episode_path;
   std::wstring folder;
   std::vector<std::wstring> synonyms;
@@ -0,0 +1,158 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unordered_map>
+
+#include "library/anime_availability.h"
+
+namespace anime {
+
+static const int kBitsPerWord = 32;
+
+static std::vector<std::wstring> folders;
+static std::unordered_map<std::wstring, unsigned int> folder_ids;
+
+static unsigned int GetFolderId(const std::wstring& folder) {
+  auto it = folder_ids.find(folder);
+  if (it != folder_ids.end())
+    return it->second;
+
+  unsigned int folder_id = static_cast<unsigned int>(folders.size());
+  folders.push_back(folder);
+  folder_ids[folder] = folder_id;
+  return folder_id;
+}
+
+// The popcnt instruction is not available on every CPU that Taiga runs on
+static int CountBits(unsigned int word) {
+  word = word - ((word >> 1) & 0x55555555);
+  word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+  word = (word + (word >> 4)) & 0x0F0F0F0F;
+  return static_cast<int>((word * 0x01010101) >> 24);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+AvailableEpisodes::AvailableEpisodes()
+    : size_(0),
+      count_(0) {
+}
+
+void AvailableEpisodes::Clear() {
+  bits_.clear();
+  files_.clear();
+  size_ = 0;
+  count_ = 0;
+}
+
+int AvailableEpisodes::size() const {
+  return size_;
+}
+
+void AvailableEpisodes::Resize(int size) {
+  if (size <= size_)
+    return;
+
+  size_ = size;
+  bits_.resize((size_ + kBitsPerWord - 1) / kBitsPerWord, 0);
+}
+
+int AvailableEpisodes::Count() const {
+  return count_;
+}
+
+int AvailableEpisodes::Count(int first, int last) const {
+  if (first < 1)
+    first = 1;
+  if (last > size_)
+    last = size_;
+  if (first > last)
+    return 0;
+
+  int count = 0;
+  size_t first_index = (first - 1) / kBitsPerWord;
+  size_t last_index = (last - 1) / kBitsPerWord;
+
+  for (size_t i = first_index; i <= last_index; i++) {
+    unsigned int word = bits_.at(i);
+    if (i == first_index)
+      word &= ~0u << ((first - 1) % kBitsPerWord);
+    if (i == last_index && last % kBitsPerWord != 0)
+      word &= ~(~0u << (last % kBitsPerWord));
+    count += CountBits(word);
+  }
+
+  return count;
+}
+
+bool AvailableEpisodes::Get(int number) const {
+  if (number < 1 || number > size_)
+    return false;
+
+  int bit = number - 1;
+  return (bits_.at(bit / kBitsPerWord) & (1u << (bit % kBitsPerWord))) != 0;
+}
+
+std::wstring AvailableEpisodes::GetPath(int number) const {
+  if (!Get(number) || static_cast<size_t>(number) > files_.size())
+    return std::wstring();
+
+  const File& file = files_.at(number - 1);
+  if (file.name.empty())
+    return std::wstring();
+
+  return folders.at(file.folder_id) + file.name;
+}
+
+void AvailableEpisodes::Set(int number, bool available,
+                            const std::wstring& path) {
+  if (number < 1)
+    return;
+
+  Resize(number);
+
+  int bit = number - 1;
+  unsigned int& word = bits_.at(bit / kBitsPerWord);
+  unsigned int mask = 1u << (bit % kBitsPerWord);
+
+  if (available && !(word & mask)) {
+    word |= mask;
+    count_++;
+  } else if (!available && (word & mask)) {
+    word &= ~mask;
+    count_--;
+  }
+
+  if (available && !path.empty()) {
+    if (files_.size() < static_cast<size_t>(number))
+      files_.resize(number);
+    File& file = files_.at(number - 1);
+    size_t pos = path.find_last_of(L"\\/");
+    if (pos == std::wstring::npos) {
+      file.folder_id = GetFolderId(std::wstring());
+      file.name = path;
+    } else {
+      file.folder_id = GetFolderId(path.substr(0, pos + 1));
+      file.name = path.substr(pos + 1);
+    }
+  } else if (!available && static_cast<size_t>(number) <= files_.size()) {
+    files_.at(number - 1).name.clear();
+  }
+}
+
+}  // namespace anime
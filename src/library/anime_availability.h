@@ -0,0 +1,66 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_LIBRARY_ANIME_AVAILABILITY_H
+#define TAIGA_LIBRARY_ANIME_AVAILABILITY_H
+
+#include <string>
+#include <vector>
+
+namespace anime {
+
+// Keeps track of the episodes of an anime that are on the computer, along
+// with their files. Availability is stored as a bitmap, and the number of
+// available episodes is kept up to date as it changes.
+class AvailableEpisodes {
+public:
+  AvailableEpisodes();
+  ~AvailableEpisodes() {}
+
+  void Clear();
+
+  // Episodes are numbered from 1 to size()
+  int size() const;
+  // Only grows, episodes that were available stay available
+  void Resize(int size);
+
+  int Count() const;
+  // Counts the available episodes in the range, both ends included
+  int Count(int first, int last) const;
+
+  bool Get(int number) const;
+  std::wstring GetPath(int number) const;
+  void Set(int number, bool available, const std::wstring& path);
+
+private:
+  // Episode files of an anime are usually in the same folder, so folders are
+  // shared by all items and stored only once
+  struct File {
+    unsigned int folder_id;
+    std::wstring name;
+  };
+
+  std::vector<unsigned int> bits_;
+  std::vector<File> files_;
+  int size_;
+  int count_;
+};
+
+}  // namespace anime
+
+#endif  // TAIGA_LIBRARY_ANIME_AVAILABILITY_H
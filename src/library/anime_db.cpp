@@ -41,7 +41,18 @@ anime::Database AnimeDatabase;
 
 namespace anime {
 
+Database::Database()
+    : revision_(0) {
+}
+
 bool Database::LoadDatabase() {
+  revision_++;
+
+  // The snapshot is only valid if it was written along with the XML file,
+  // otherwise we fall back to reading XML.
+  if (LoadSnapshot())
+    return true;
+
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
   unsigned int options = pugi::parse_default & ~pugi::parse_eol;
@@ -136,7 +147,13 @@ bool Database::SaveDatabase() {
   WriteDatabaseNode(database_node);
 
   std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
-  return XmlWriteDocumentToFile(document, path);
+  if (!XmlWriteDocumentToFile(document, path))
+    return false;
+
+  if (!SaveSnapshot())
+    LOG(LevelWarning, L"Could not save database snapshot");
+
+  return true;
 }
 
 void Database::WriteDatabaseNode(xml_node& database_node) {
@@ -206,14 +223,27 @@ Item* Database::FindItem(int id) {
 }
 
 Item* Database::FindItem(const std::wstring& id, enum_t service) {
-  if (!id.empty())
-    foreach_(it, items)
-      if (id == it->second.GetId(service))
-        return &it->second;
+  if (!id.empty()) {
+    auto index = id_index_.find(service);
+    if (index != id_index_.end()) {
+      auto it = index->second.find(id);
+      if (it != index->second.end() && it->second->GetId(service) == id)
+        return it->second;
+    }
+  }
 
   return nullptr;
 }
 
+Item* Database::FindItemByFolder(const std::wstring& path) {
+  int anime_id = path_index_.FindFolder(path);
+  return anime_id ? FindItem(anime_id) : nullptr;
+}
+
+const PathIndex& Database::path_index() const {
+  return path_index_;
+}
+
 Item* Database::FindSequel(int anime_id) {
   if (taiga::GetCurrentServiceId() != sync::kMyAnimeList)
     return nullptr;
@@ -243,9 +273,19 @@ Item* Database::FindSequel(int anime_id) {
 ////////////////////////////////////////////////////////////////////////////////
 
 void Database::ClearInvalidItems() {
+  revision_++;
+
   for (auto it = items.begin(); it != items.end(); ) {
     if (!it->second.GetId() || it->first != it->second.GetId()) {
       LOG(LevelDebug, L"ID: " + ToWstr(it->first));
+      RemoveFromIdIndex(it->second);
+      // Titles and paths are indexed by the item's own ID, which may belong to
+      // another item that is kept
+      const int id = it->second.GetId();
+      if (id == it->first || items.find(id) == items.end()) {
+        Meow.RemoveItem(id);
+        path_index_.Remove(id);
+      }
       items.erase(it++);
     } else {
       ++it;
@@ -253,7 +293,19 @@ void Database::ClearInvalidItems() {
   }
 }
 
+void Database::ClearItems() {
+  revision_++;
+
+  id_index_.clear();
+  path_index_.Clear();
+  items.clear();
+
+  Meow.Clear();
+}
+
 int Database::UpdateItem(const Item& new_item) {
+  revision_++;
+
   Item* item = nullptr;
 
   for (enum_t i = sync::kTaiga; i <= sync::kLastService; i++) {
@@ -357,6 +409,53 @@ int Database::UpdateItem(const Item& new_item) {
   return item->GetId();
 }
 
+unsigned int Database::revision() const {
+  return revision_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Database::UpdateIdIndex(Item& item, enum_t service,
+                             const std::wstring& previous_id) {
+  auto& index = id_index_[service];
+
+  // The previous entry is removed even if the item is no longer found by its
+  // ID, which is the case when its Taiga ID has changed
+  if (!previous_id.empty()) {
+    auto previous = index.find(previous_id);
+    if (previous != index.end() && previous->second == &item)
+      index.erase(previous);
+  }
+
+  // Temporary items (e.g. the ones that are created while parsing a service
+  // response) are not indexed, only the ones that are held in the database.
+  auto it = items.find(item.GetId());
+  if (it == items.end() || &it->second != &item)
+    return;
+
+  const std::wstring& id = item.GetId(service);
+  if (!id.empty())
+    index[id] = &item;
+}
+
+void Database::RemoveFromIdIndex(const Item& item) {
+  foreach_(index, id_index_) {
+    auto it = index->second.find(item.GetId(index->first));
+    if (it != index->second.end() && it->second == &item)
+      index->second.erase(it);
+  }
+}
+
+void Database::UpdatePathIndex(const Item& item, int key,
+                               const std::wstring& path) {
+  // Same as the ID index, temporary items are not indexed
+  auto it = items.find(item.GetId());
+  if (it == items.end() || &it->second != &item)
+    return;
+
+  path_index_.Set(item.GetId(), key, path);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -583,11 +682,6 @@ void Database::UpdateItem(const HistoryItem& history_item) {
     DeleteListItem(anime_item->GetId());
   }
 
-  SaveList();
-
-  History.queue.Remove();
-  History.queue.Check(false);
-
   ui::OnLibraryEntryChange(history_item.anime_id);
 }
 
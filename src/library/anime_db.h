@@ -20,8 +20,10 @@
 #define TAIGA_LIBRARY_ANIME_DB_H
 
 #include <map>
+#include <unordered_map>
 
 #include "library/anime_item.h"
+#include "library/anime_path_index.h"
 
 class HistoryItem;
 namespace pugi {
@@ -33,6 +35,8 @@ namespace anime {
 
 class Database {
 public:
+  Database();
+
   bool LoadDatabase();
   bool SaveDatabase();
 
@@ -40,9 +44,18 @@ public:
   Item* FindItem(const std::wstring& id, enum_t service);
   Item* FindSequel(int anime_id);
 
+  // Returns the item whose folder is the deepest one to contain the path
+  Item* FindItemByFolder(const std::wstring& path);
+  const PathIndex& path_index() const;
+
   void ClearInvalidItems();
+  void ClearItems();
   int UpdateItem(const Item& item);
 
+  // Incremented whenever items are loaded, removed or updated from a source,
+  // so that results that depend on anime information can be cached
+  unsigned int revision() const;
+
 public:
   bool LoadList();
   bool SaveList(bool include_database = false);
@@ -58,14 +71,37 @@ public:
   std::map<int, Item> items;
 
 private:
+  friend class Item;
+
+  // Called by Item::SetId to keep the ID index up to date
+  void UpdateIdIndex(Item& item, enum_t service, const std::wstring& previous_id);
+  void RemoveFromIdIndex(const Item& item);
+  // Called by Item when its folder or episode paths change
+  void UpdatePathIndex(const Item& item, int key, const std::wstring& path);
+
   void ReadDatabaseNode(pugi::xml_node& database_node);
   void WriteDatabaseNode(pugi::xml_node& database_node);
 
+  // Binary copy of the database that is faster to read than XML, see
+  // anime_db_snapshot.cpp
+  bool LoadSnapshot();
+  bool SaveSnapshot();
+
   bool CheckOldUserDirectory();
   void ClearInvalidValues(Item& item);
   void HandleCompatibility(const std::wstring& meta_version);
   void ReadDatabaseInCompatibilityMode(pugi::xml_document& document);
   void ReadListInCompatibilityMode(pugi::xml_document& document);
+
+  // Maps service IDs to items that are held in the database, so that they can
+  // be found without iterating over all items.
+  std::map<enum_t, std::unordered_map<std::wstring, Item*>> id_index_;
+
+  // Maps local paths to items, so that file changes can be handled without
+  // iterating over all items
+  PathIndex path_index_;
+
+  unsigned int revision_;
 };
 
 }  // namespace anime
@@ -0,0 +1,486 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <windows.h>
+
+#include <zlib/zlib.h>
+
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/log.h"
+#include "base/string.h"
+#include "library/anime_db.h"
+#include "sync/manager.h"
+#include "sync/service.h"
+#include "taiga/path.h"
+#include "taiga/settings.h"
+#include "taiga/taiga.h"
+
+// The snapshot is a binary copy of db\anime.xml, which is written alongside it
+// and read back at startup without going through the XML parser. It is laid
+// out as follows:
+//
+//   SnapshotHeader
+//   SnapshotItem[item_count]
+//   SnapshotString[string_count]  (offset and length within character data)
+//   uint32_t[list_count]          (string indices, for synonyms, genres, etc.)
+//   wchar_t[char_count]           (character data)
+//
+// Strings are referred to by their index, and index 0 is always the empty
+// string. The checksum covers everything after the header.
+
+namespace anime {
+
+namespace {
+
+const char kSnapshotMagic[8] = {'T', 'A', 'I', 'G', 'A', 'D', 'B', '\0'};
+
+// Must be increased whenever the layout below changes
+const uint32_t kSnapshotVersion = 1;
+
+const size_t kSnapshotServiceCount = sync::kLastService + 1;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t checksum;
+  uint64_t xml_size;
+  uint64_t xml_write_time;
+  uint32_t meta_version;
+  uint32_t item_count;
+  uint32_t string_count;
+  uint32_t list_count;
+  uint32_t char_count;
+  uint32_t reserved;
+};
+
+struct SnapshotList {
+  uint32_t first;
+  uint32_t count;
+};
+
+struct SnapshotItem {
+  int64_t modified;
+  uint32_t id[kSnapshotServiceCount];
+  uint32_t source;
+  uint32_t slug;
+  uint32_t title;
+  uint32_t english;
+  uint32_t image;
+  uint32_t synopsis;
+  int32_t type;
+  int32_t status;
+  int32_t episode_count;
+  int32_t episode_length;
+  int32_t age_rating;
+  int32_t popularity;
+  uint16_t date_start[3];
+  uint16_t date_end[3];
+  double score;
+  SnapshotList synonyms;
+  SnapshotList genres;
+  SnapshotList producers;
+};
+
+struct SnapshotString {
+  uint32_t offset;
+  uint32_t length;
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0,
+              "Invalid snapshot header size");
+static_assert(sizeof(SnapshotItem) % 8 == 0,
+              "Invalid snapshot item size");
+static_assert(sizeof(wchar_t) == 2,
+              "Snapshot strings are stored as UTF-16");
+
+bool GetXmlFileStamp(uint64_t& size, uint64_t& write_time) {
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnime);
+
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+    return false;
+
+  size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) |
+         data.nFileSizeLow;
+  write_time = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+               data.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+
+uint32_t CalculateChecksum(const void* data, size_t length) {
+  uLong crc = crc32(0L, Z_NULL, 0);
+  return crc32(crc, reinterpret_cast<const Bytef*>(data),
+               static_cast<uInt>(length));
+}
+
+class SnapshotWriter {
+public:
+  SnapshotWriter() {
+    AddString(EmptyString());
+  }
+
+  uint32_t AddString(const std::wstring& str) {
+    auto it = string_map_.find(str);
+    if (it != string_map_.end())
+      return it->second;
+
+    SnapshotString entry;
+    entry.offset = static_cast<uint32_t>(chars_.size());
+    entry.length = static_cast<uint32_t>(str.size());
+    chars_.insert(chars_.end(), str.begin(), str.end());
+
+    uint32_t index = static_cast<uint32_t>(strings_.size());
+    strings_.push_back(entry);
+    string_map_.insert(std::make_pair(str, index));
+    return index;
+  }
+
+  SnapshotList AddList(const std::vector<std::wstring>& list) {
+    SnapshotList entry;
+    entry.first = static_cast<uint32_t>(lists_.size());
+    entry.count = static_cast<uint32_t>(list.size());
+    foreach_(it, list)
+      lists_.push_back(AddString(*it));
+    return entry;
+  }
+
+  void AddItem(const SnapshotItem& item) {
+    items_.push_back(item);
+  }
+
+  void Write(SnapshotHeader& header, std::string& output) const {
+    header.item_count = static_cast<uint32_t>(items_.size());
+    header.string_count = static_cast<uint32_t>(strings_.size());
+    header.list_count = static_cast<uint32_t>(lists_.size());
+    header.char_count = static_cast<uint32_t>(chars_.size());
+
+    output.assign(sizeof(SnapshotHeader), '\0');
+    Append(output, items_);
+    Append(output, strings_);
+    Append(output, lists_);
+    Append(output, chars_);
+
+    header.checksum = CalculateChecksum(
+        output.data() + sizeof(SnapshotHeader),
+        output.size() - sizeof(SnapshotHeader));
+    memcpy(&output[0], &header, sizeof(SnapshotHeader));
+  }
+
+private:
+  template <typename T>
+  static void Append(std::string& output, const std::vector<T>& input) {
+    if (!input.empty())
+      output.append(reinterpret_cast<const char*>(&input.front()),
+                    input.size() * sizeof(T));
+  }
+
+  std::vector<SnapshotItem> items_;
+  std::vector<SnapshotString> strings_;
+  std::vector<uint32_t> lists_;
+  std::vector<wchar_t> chars_;
+  std::map<std::wstring, uint32_t> string_map_;
+};
+
+class SnapshotReader {
+public:
+  SnapshotReader(const char* data, size_t size)
+      : data_(data), size_(size), header_(nullptr), items_(nullptr),
+        strings_(nullptr), lists_(nullptr), chars_(nullptr) {
+  }
+
+  bool Validate(uint64_t xml_size, uint64_t xml_write_time) {
+    if (size_ < sizeof(SnapshotHeader))
+      return false;
+    header_ = reinterpret_cast<const SnapshotHeader*>(data_);
+
+    if (memcmp(header_->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+        header_->version != kSnapshotVersion)
+      return false;
+
+    // The snapshot is out of date if the XML file was modified afterwards
+    if (header_->xml_size != xml_size ||
+        header_->xml_write_time != xml_write_time)
+      return false;
+
+    uint64_t expected_size = sizeof(SnapshotHeader) +
+        static_cast<uint64_t>(header_->item_count) * sizeof(SnapshotItem) +
+        static_cast<uint64_t>(header_->string_count) * sizeof(SnapshotString) +
+        static_cast<uint64_t>(header_->list_count) * sizeof(uint32_t) +
+        static_cast<uint64_t>(header_->char_count) * sizeof(wchar_t);
+    if (expected_size != size_ || header_->string_count == 0)
+      return false;
+
+    if (CalculateChecksum(data_ + sizeof(SnapshotHeader),
+                          size_ - sizeof(SnapshotHeader)) != header_->checksum)
+      return false;
+
+    const char* p = data_ + sizeof(SnapshotHeader);
+    items_ = reinterpret_cast<const SnapshotItem*>(p);
+    p += header_->item_count * sizeof(SnapshotItem);
+    strings_ = reinterpret_cast<const SnapshotString*>(p);
+    p += header_->string_count * sizeof(SnapshotString);
+    lists_ = reinterpret_cast<const uint32_t*>(p);
+    p += header_->list_count * sizeof(uint32_t);
+    chars_ = reinterpret_cast<const wchar_t*>(p);
+
+    for (uint32_t i = 0; i < header_->string_count; ++i) {
+      const SnapshotString& entry = strings_[i];
+      if (static_cast<uint64_t>(entry.offset) + entry.length >
+          header_->char_count)
+        return false;
+    }
+    for (uint32_t i = 0; i < header_->list_count; ++i) {
+      if (lists_[i] >= header_->string_count)
+        return false;
+    }
+
+    return true;
+  }
+
+  const SnapshotHeader& header() const {
+    return *header_;
+  }
+
+  const SnapshotItem& item(uint32_t index) const {
+    return items_[index];
+  }
+
+  std::wstring GetString(uint32_t index) const {
+    if (index >= header_->string_count)
+      return std::wstring();
+    const SnapshotString& entry = strings_[index];
+    return std::wstring(chars_ + entry.offset, entry.length);
+  }
+
+  void GetList(const SnapshotList& list,
+               std::vector<std::wstring>& output) const {
+    output.clear();
+    if (static_cast<uint64_t>(list.first) + list.count > header_->list_count)
+      return;
+    output.reserve(list.count);
+    for (uint32_t i = 0; i < list.count; ++i)
+      output.push_back(GetString(lists_[list.first + i]));
+  }
+
+private:
+  const char* data_;
+  size_t size_;
+  const SnapshotHeader* header_;
+  const SnapshotItem* items_;
+  const SnapshotString* strings_;
+  const uint32_t* lists_;
+  const wchar_t* chars_;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  MappedFile()
+      : file_(INVALID_HANDLE_VALUE), mapping_(nullptr), view_(nullptr),
+        size_(0) {
+  }
+  ~MappedFile() {
+    if (view_)
+      UnmapViewOfFile(view_);
+    if (mapping_)
+      CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE)
+      CloseHandle(file_);
+  }
+
+  bool Open(const std::wstring& path) {
+    file_ = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE)
+      return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0 ||
+        static_cast<uint64_t>(size.QuadPart) > SIZE_MAX)
+      return false;
+    size_ = static_cast<size_t>(size.QuadPart);
+
+    mapping_ = CreateFileMapping(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_)
+      return false;
+
+    view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    return view_ != nullptr;
+  }
+
+  const char* data() const { return static_cast<const char*>(view_); }
+  size_t size() const { return size_; }
+
+private:
+  HANDLE file_;
+  HANDLE mapping_;
+  LPVOID view_;
+  size_t size_;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool Database::LoadSnapshot() {
+  uint64_t xml_size = 0;
+  uint64_t xml_write_time = 0;
+  if (!GetXmlFileStamp(xml_size, xml_write_time))
+    return false;
+
+  MappedFile file;
+  if (!file.Open(taiga::GetPath(taiga::kPathDatabaseAnimeSnapshot)))
+    return false;
+
+  SnapshotReader reader(file.data(), file.size());
+  if (!reader.Validate(xml_size, xml_write_time)) {
+    LOG(LevelWarning, L"Invalid or outdated snapshot, reading XML instead");
+    return false;
+  }
+
+  std::vector<std::wstring> synonyms;
+  std::vector<std::wstring> genres;
+  std::vector<std::wstring> producers;
+
+  for (uint32_t i = 0; i < reader.header().item_count; ++i) {
+    const SnapshotItem& record = reader.item(i);
+
+    std::map<enum_t, std::wstring> id_map;
+    for (enum_t service = sync::kTaiga; service <= sync::kLastService; service++) {
+      std::wstring id = reader.GetString(record.id[service]);
+      if (!id.empty())
+        id_map[service] = id;
+    }
+
+    // Same rules as in ReadDatabaseNode
+    enum_t source = static_cast<enum_t>(record.source);
+    if (source == sync::kTaiga) {
+      auto current_service_id = taiga::GetCurrentServiceId();
+      if (id_map.find(current_service_id) != id_map.end()) {
+        source = current_service_id;
+        LOG(LevelWarning, L"Fixed source for ID: " + id_map[source]);
+      } else {
+        LOG(LevelError, L"Invalid source for ID: " + id_map[sync::kTaiga]);
+        continue;
+      }
+    }
+
+    Item& item = items[ToInt(id_map[sync::kTaiga])];  // Creates the item if it doesn't exist
+
+    foreach_(it, id_map)
+      item.SetId(it->second, it->first);
+
+    reader.GetList(record.synonyms, synonyms);
+    reader.GetList(record.genres, genres);
+    reader.GetList(record.producers, producers);
+
+    item.SetSource(source);
+    item.SetSlug(reader.GetString(record.slug));
+
+    item.SetTitle(reader.GetString(record.title));
+    item.SetEnglishTitle(reader.GetString(record.english));
+    item.SetSynonyms(synonyms);
+    item.SetType(record.type);
+    item.SetAiringStatus(record.status);
+    item.SetEpisodeCount(record.episode_count);
+    item.SetEpisodeLength(record.episode_length);
+    item.SetDateStart(Date(record.date_start[0], record.date_start[1],
+                           record.date_start[2]));
+    item.SetDateEnd(Date(record.date_end[0], record.date_end[1],
+                         record.date_end[2]));
+    item.SetImageUrl(reader.GetString(record.image));
+    item.SetAgeRating(record.age_rating);
+    item.SetGenres(genres);
+    item.SetProducers(producers);
+    item.SetScore(record.score);
+    item.SetPopularity(record.popularity);
+    item.SetSynopsis(reader.GetString(record.synopsis));
+    item.SetLastModified(static_cast<time_t>(record.modified));
+  }
+
+  HandleCompatibility(reader.GetString(reader.header().meta_version));
+
+  return true;
+}
+
+bool Database::SaveSnapshot() {
+  SnapshotHeader header = {};
+  memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.version = kSnapshotVersion;
+  if (!GetXmlFileStamp(header.xml_size, header.xml_write_time))
+    return false;
+
+  SnapshotWriter writer;
+  header.meta_version = writer.AddString(std::wstring(Taiga.version));
+
+  // Values are stored the same way WriteDatabaseNode would store them, so that
+  // loading from either file results in identical items.
+  auto positive = [](int value) { return value > 0 ? value : 0; };
+  auto copy_date = [](const Date& date, uint16_t* output) {
+    Date value = date ? date : Date();
+    output[0] = value.year;
+    output[1] = value.month;
+    output[2] = value.day;
+  };
+
+  foreach_(it, items) {
+    const Item& item = it->second;
+    SnapshotItem record = {};
+
+    for (enum_t service = sync::kTaiga; service <= sync::kLastService; service++)
+      record.id[service] = writer.AddString(item.GetId(service));
+
+    auto source = ServiceManager.service(
+        ServiceManager.GetServiceNameById(
+            static_cast<sync::ServiceId>(item.GetSource())));
+    record.source = source ? source->id() : sync::kTaiga;
+
+    record.modified = item.GetLastModified();
+    record.slug = writer.AddString(item.GetSlug());
+    record.title = writer.AddString(item.GetTitle());
+    record.english = writer.AddString(item.GetEnglishTitle());
+    record.image = writer.AddString(item.GetImageUrl());
+    record.synopsis = writer.AddString(item.GetSynopsis());
+    record.type = positive(item.GetType());
+    record.status = positive(item.GetAiringStatus());
+    record.episode_count = positive(item.GetEpisodeCount());
+    record.episode_length = positive(item.GetEpisodeLength());
+    record.age_rating = positive(item.GetAgeRating());
+    record.popularity = positive(item.GetPopularity());
+    record.score = item.GetScore() > 0.0 ? item.GetScore() : 0.0;
+    copy_date(item.GetDateStart(), record.date_start);
+    copy_date(item.GetDateEnd(), record.date_end);
+    record.synonyms = writer.AddList(item.GetSynonyms());
+    record.genres = writer.AddList(item.GetGenres());
+    record.producers = writer.AddList(item.GetProducers());
+
+    writer.AddItem(record);
+  }
+
+  std::string output;
+  writer.Write(header, output);
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseAnimeSnapshot);
+  return SaveToFile(output, path);
+}
+
+}  // namespace anime
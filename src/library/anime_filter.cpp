@@ -26,42 +26,46 @@ Filters::Filters() {
   Reset();
 }
 
+// Returns true if the filter excludes the value at index
+static bool IsExcluded(const std::vector<bool>& filter, int index) {
+  return index >= 0 && index < static_cast<int>(filter.size()) &&
+         !filter.at(index);
+}
+
 bool Filters::CheckItem(Item& item) {
   // Filter my status
-  for (size_t i = 0; i < my_status.size(); i++)
-    if (!my_status.at(i) && item.GetMyStatus() == i)
-      return false;
+  int item_my_status = item.GetMyStatus();
+  if (IsExcluded(my_status, item_my_status))
+    return false;
 
   // Filter airing status
-  for (size_t i = 0; i < status.size(); i++)
-    if (!status.at(i) && item.GetAiringStatus() == i + 1)
-      return false;
+  if (IsExcluded(status, item.GetAiringStatus() - 1))
+    return false;
 
   // Filter type
-  for (size_t i = 0; i < type.size(); i++)
-    if (!type.at(i) && item.GetType() == i + 1)
-      return false;
+  if (IsExcluded(type, item.GetType() - 1))
+    return false;
 
   // Filter text
-  std::vector<std::wstring> words;
-  Split(text, L" ", words);
-  RemoveEmptyStrings(words);
-  std::wstring genres = Join(item.GetGenres(), L", ");
-  auto synonyms = item.GetSynonyms();
-  for (auto it = words.begin(); it != words.end(); ++it) {
-    if (InStr(item.GetTitle(), *it, 0, true) == -1 &&
-        InStr(genres, *it, 0, true) == -1 &&
-        InStr(item.GetMyTags(), *it, 0, true) == -1) {
-      bool found = false;
-      for (auto synonym = synonyms.begin();
-           !found && synonym != synonyms.end(); ++synonym)
-        if (InStr(*synonym, *it, 0, true) > -1) found = true;
-      if (item.IsInList())
-        for (auto synonym = item.GetUserSynonyms().begin();
-             !found && synonym != item.GetUserSynonyms().end(); ++synonym)
-          if (InStr(*synonym, *it, 0, true) > -1) found = true;
-      if (!found) return false;
-    }
+  if (compiled_text_ != text)
+    Compile();
+  if (searchers_.empty())
+    return true;
+  size_t user_synonyms_pos = 0;
+  const std::wstring& search_text = item.GetSearchText(user_synonyms_pos);
+  const std::wstring* tags = nullptr;
+  for (auto it = searchers_.begin(); it != searchers_.end(); ++it) {
+    int pos = it->FindFolded(search_text);
+    if (pos > -1 && static_cast<size_t>(pos) < user_synonyms_pos)
+      continue;
+    if (!tags)
+      tags = &item.GetMyTags();
+    if (it->Find(*tags) > -1)
+      continue;
+    // User synonyms are only searched for items in the list
+    if (pos > -1 && item_my_status != kNotInList)
+      continue;
+    return false;
   }
 
   // Item passed all filters
@@ -78,6 +82,20 @@ void Filters::Reset() {
   type.resize(6, true);
 
   text = L"";
+  compiled_text_.clear();
+  searchers_.clear();
+}
+
+void Filters::Compile() {
+  std::vector<std::wstring> words;
+  Split(text, L" ", words);
+  RemoveEmptyStrings(words);
+
+  searchers_.clear();
+  for (auto it = words.begin(); it != words.end(); ++it)
+    searchers_.push_back(CaseInsensitiveSearcher(*it));
+
+  compiled_text_ = text;
 }
 
 }  // namespace anime
\ No newline at end of file
@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include "base/string.h"
+
 namespace anime {
 
 class Item;
@@ -38,6 +40,13 @@ class Filters {
   std::vector<bool> status;
   std::vector<bool> type;
   std::wstring text;
+
+ private:
+  void Compile();
+
+  // Words of the text, compiled when the text changes
+  std::wstring compiled_text_;
+  std::vector<CaseInsensitiveSearcher> searchers_;
 };
 
 }  // namespace anime
@@ -32,7 +32,8 @@ anime::Database* anime::Item::database_ = &AnimeDatabase;
 
 namespace anime {
 
-Item::Item() {
+Item::Item()
+    : search_text_user_pos_(0) {
   metadata_.uid.resize(sync::kLastService + 1);
 }
 
@@ -182,7 +183,13 @@ void Item::SetId(const std::wstring& id, enum_t service) {
   if (metadata_.uid.size() < static_cast<size_t>(service) + 1)
     metadata_.uid.resize(service + 1);
 
+  if (metadata_.uid.at(service) == id)
+    return;
+
+  std::wstring previous_id = metadata_.uid.at(service);
   metadata_.uid.at(service) = id;
+
+  database_->UpdateIdIndex(*this, service, previous_id);
 }
 
 void Item::SetSlug(const std::wstring& slug) {
@@ -208,8 +215,7 @@ void Item::SetEpisodeCount(int number) {
 
   // TODO: Call it separately
   if (number >= 0)
-    if (static_cast<size_t>(number) > local_info_.available_episodes.size())
-      local_info_.available_episodes.resize(number);
+    local_info_.available_episodes.Resize(number);
 }
 
 void Item::SetEpisodeLength(int number) {
@@ -225,6 +231,7 @@ void Item::SetAiringStatus(int status) {
 
 void Item::SetTitle(const std::wstring& title) {
   metadata_.title = title;
+  ClearSearchText();
 }
 
 void Item::SetEnglishTitle(const std::wstring& title) {
@@ -267,6 +274,7 @@ void Item::SetSynonyms(const std::vector<std::wstring>& synonyms) {
   }
 
   metadata_.alternative = alternative;
+  ClearSearchText();
 }
 
 void Item::SetDateStart(const Date& date) {
@@ -304,6 +312,7 @@ void Item::SetGenres(const std::wstring& genres) {
 
 void Item::SetGenres(const std::vector<std::wstring>& genres) {
   metadata_.subject = genres;
+  ClearSearchText();
 }
 
 void Item::SetPopularity(int popularity) {
@@ -502,8 +511,12 @@ void Item::SetMyTags(const std::wstring& tags) {
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
+const AvailableEpisodes& Item::GetAvailableEpisodes() const {
+  return local_info_.available_episodes;
+}
+
 int Item::GetAvailableEpisodeCount() const {
-  return static_cast<int>(local_info_.available_episodes.size());
+  return local_info_.available_episodes.size();
 }
 
 const std::wstring& Item::GetFolder() const {
@@ -554,12 +567,10 @@ bool Item::SetEpisodeAvailability(int number, bool available,
     number = 1;
 
   if (number <= GetEpisodeCount() || GetEpisodeCount() == 0) {
-    if (static_cast<size_t>(number) > local_info_.available_episodes.size()) {
-      local_info_.available_episodes.resize(number);
-    }
-    local_info_.available_episodes.at(number - 1) = available;
+    local_info_.available_episodes.Set(number, available, path);
+    database_->UpdatePathIndex(*this, number, available ? path : L"");
     if (number == GetMyLastWatchedEpisode() + 1) {
-      SetNextEpisodePath(path);
+      SetNextEpisodePath(available ? path : L"");
     }
 
     ui::OnLibraryEntryChange(GetId());
@@ -572,6 +583,7 @@ bool Item::SetEpisodeAvailability(int number, bool available,
 
 void Item::SetFolder(const std::wstring& folder) {
   local_info_.folder = folder;
+  database_->UpdatePathIndex(*this, PathIndex::kKeyFolder, folder);
 }
 
 void Item::SetLastAiredEpisodeNumber(int number) {
@@ -581,6 +593,7 @@ void Item::SetLastAiredEpisodeNumber(int number) {
 
 void Item::SetNextEpisodePath(const std::wstring& path) {
   local_info_.next_episode_path = path;
+  database_->UpdatePathIndex(*this, PathIndex::kKeyNextEpisode, path);
 }
 
 void Item::SetPlaying(bool playing) {
@@ -601,6 +614,7 @@ void Item::SetUserSynonyms(const std::wstring& synonyms) {
 void Item::SetUserSynonyms(const std::vector<std::wstring>& synonyms) {
   local_info_.synonyms = synonyms;
   RemoveEmptyStrings(local_info_.synonyms);
+  ClearSearchText();
 
   if (!synonyms.empty() && CurrentEpisode.anime_id == anime::ID_NOTINLIST) {
     CurrentEpisode.Set(anime::ID_UNKNOWN);
@@ -612,10 +626,8 @@ void Item::SetUserSynonyms(const std::vector<std::wstring>& synonyms) {
 bool Item::IsEpisodeAvailable(int number) const {
   if (number < 1)
     number = 1;
-  if (static_cast<size_t>(number) > local_info_.available_episodes.size())
-    return false;
 
-  return local_info_.available_episodes.at(number - 1);
+  return local_info_.available_episodes.Get(number);
 }
 
 bool Item::IsNewEpisodeAvailable() const {
@@ -626,6 +638,27 @@ bool Item::UserSynonymsAvailable() const {
   return !local_info_.synonyms.empty();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+const std::wstring& Item::GetSearchText(size_t& user_synonyms_pos) const {
+  // Parts are separated by a character that search words can't contain, so
+  // that a match can't span two of them
+  if (search_text_.empty()) {
+    search_text_ = metadata_.title + L'\n' +
+                   Join(metadata_.subject, L", ") + L'\n';
+    foreach_(it, metadata_.alternative)
+      if (it->type == library::kTitleTypeSynonym)
+        search_text_ += it->value + L'\n';
+    search_text_user_pos_ = search_text_.size();
+    foreach_(it, local_info_.synonyms)
+      search_text_ += *it + L'\n';
+    CaseInsensitiveSearcher::FoldCase(search_text_);
+  }
+
+  user_synonyms_pos = search_text_user_pos_;
+  return search_text_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -651,4 +684,9 @@ HistoryItem* Item::SearchHistory(int search_mode) const {
   return History.queue.FindItem(GetId(), search_mode);
 }
 
+void Item::ClearSearchText() {
+  search_text_.clear();
+  search_text_user_pos_ = 0;
+}
+
 }  // namespace anime
\ No newline at end of file
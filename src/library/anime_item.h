@@ -118,6 +118,7 @@ public:
   //////////////////////////////////////////////////////////////////////////////
   // Local data
 
+  const AvailableEpisodes& GetAvailableEpisodes() const;
   int GetAvailableEpisodeCount() const;
   const std::wstring& GetFolder() const;
   int GetLastAiredEpisodeNumber(bool estimate = false);
@@ -141,6 +142,13 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
 
+  // Returns the title, genres, synonyms and user synonyms in a single string,
+  // folded for CaseInsensitiveSearcher::FindFolded. User synonyms begin at
+  // user_synonyms_pos.
+  const std::wstring& GetSearchText(size_t& user_synonyms_pos) const;
+
+  //////////////////////////////////////////////////////////////////////////////
+
   // A database item may not be in user's list.
   void AddtoUserList();
   bool IsInList() const;
@@ -149,6 +157,7 @@ public:
 private:
   // Helper function
   HistoryItem* SearchHistory(int search_mode) const;
+  void ClearSearchText();
 
   // Series information, stored in db\anime.xml
   library::Metadata metadata_;
@@ -160,6 +169,10 @@ private:
   // Local information, stored temporarily
   LocalInformation local_info_;
 
+  // Built on demand, and cleared when the text it is made of changes
+  mutable std::wstring search_text_;
+  mutable size_t search_text_user_pos_;
+
   // Pointer to the parent database which holds this item
   static Database* database_;
 };
@@ -0,0 +1,227 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "base/string.h"
+#include "library/anime_path_index.h"
+
+namespace anime {
+
+const size_t kRoot = 0;
+const size_t kNoNode = static_cast<size_t>(-1);
+
+PathIndex::PathIndex() {
+  Clear();
+}
+
+void PathIndex::Clear() {
+  nodes_.clear();
+  nodes_.resize(1);  // Root
+  free_nodes_.clear();
+  paths_.clear();
+}
+
+void PathIndex::Remove(int anime_id) {
+  auto it = paths_.lower_bound(std::make_pair(anime_id, kKeyNextEpisode));
+  while (it != paths_.end() && it->first.first == anime_id) {
+    RemoveOwner(it->second, anime_id, it->first.second);
+    paths_.erase(it++);
+  }
+}
+
+void PathIndex::Set(int anime_id, int key, const std::wstring& path) {
+  auto id_key = std::make_pair(anime_id, key);
+  auto it = paths_.find(id_key);
+
+  if (it != paths_.end()) {
+    if (it->second == path)
+      return;
+    RemoveOwner(it->second, anime_id, key);
+    paths_.erase(it);
+  }
+
+  if (path.empty())
+    return;
+
+  std::vector<std::wstring> components;
+  SplitPath(path, components);
+  if (components.empty())
+    return;
+
+  size_t index = kRoot;
+  for (auto component = components.begin();
+       component != components.end(); ++component) {
+    auto child = nodes_.at(index).children.find(*component);
+    if (child != nodes_.at(index).children.end()) {
+      index = child->second;
+    } else {
+      size_t new_index = NewNode();
+      nodes_.at(index).children[*component] = new_index;
+      index = new_index;
+    }
+  }
+
+  Owner owner = {anime_id, key};
+  nodes_.at(index).owners.push_back(owner);
+  paths_[id_key] = path;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const std::wstring& PathIndex::GetPath(int anime_id, int key) const {
+  auto it = paths_.find(std::make_pair(anime_id, key));
+  return it != paths_.end() ? it->second : EmptyString();
+}
+
+bool PathIndex::Find(const std::wstring& path,
+                     std::vector<Owner>& owners) const {
+  owners.clear();
+
+  size_t index = FindNode(path);
+  if (index != kNoNode && index != kRoot)
+    owners = nodes_.at(index).owners;
+
+  return !owners.empty();
+}
+
+int PathIndex::FindFolder(const std::wstring& path) const {
+  std::vector<std::wstring> components;
+  SplitPath(path, components);
+
+  int anime_id = 0;
+  size_t index = kRoot;
+
+  for (auto component = components.begin();
+       component != components.end(); ++component) {
+    const auto& children = nodes_.at(index).children;
+    auto child = children.find(*component);
+    if (child == children.end())
+      break;
+    index = child->second;
+    const auto& owners = nodes_.at(index).owners;
+    for (auto owner = owners.begin(); owner != owners.end(); ++owner) {
+      if (owner->key == kKeyFolder) {
+        anime_id = owner->anime_id;
+        break;
+      }
+    }
+  }
+
+  return anime_id;
+}
+
+void PathIndex::FindAll(const std::wstring& path,
+                        std::vector<Owner>& owners) const {
+  owners.clear();
+
+  size_t index = FindNode(path);
+  if (index == kNoNode || index == kRoot)
+    return;
+
+  std::vector<size_t> indexes(1, index);
+  while (!indexes.empty()) {
+    const Node& node = nodes_.at(indexes.back());
+    indexes.pop_back();
+    owners.insert(owners.end(), node.owners.begin(), node.owners.end());
+    for (auto child = node.children.begin();
+         child != node.children.end(); ++child)
+      indexes.push_back(child->second);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Paths are compared case-insensitively, and both kinds of slashes separate
+// their components
+void PathIndex::SplitPath(const std::wstring& path,
+                          std::vector<std::wstring>& components) {
+  components.clear();
+
+  size_t pos = 0;
+  while (pos < path.size()) {
+    size_t end = path.find_first_of(L"\\/", pos);
+    if (end == std::wstring::npos)
+      end = path.size();
+    if (end > pos) {
+      components.push_back(path.substr(pos, end - pos));
+      CaseInsensitiveSearcher::FoldCase(components.back());
+    }
+    pos = end + 1;
+  }
+}
+
+size_t PathIndex::FindNode(const std::wstring& path) const {
+  std::vector<std::wstring> components;
+  SplitPath(path, components);
+
+  size_t index = kRoot;
+  for (auto component = components.begin();
+       component != components.end(); ++component) {
+    const auto& children = nodes_.at(index).children;
+    auto child = children.find(*component);
+    if (child == children.end())
+      return kNoNode;
+    index = child->second;
+  }
+
+  return index;
+}
+
+size_t PathIndex::NewNode() {
+  if (!free_nodes_.empty()) {
+    size_t index = free_nodes_.back();
+    free_nodes_.pop_back();
+    return index;
+  }
+
+  nodes_.resize(nodes_.size() + 1);
+  return nodes_.size() - 1;
+}
+
+// Nodes that are left without owners or children are freed
+void PathIndex::RemoveOwner(const std::wstring& path, int anime_id, int key) {
+  std::vector<std::wstring> components;
+  SplitPath(path, components);
+
+  std::vector<size_t> indexes(1, kRoot);
+  for (auto component = components.begin();
+       component != components.end(); ++component) {
+    const auto& children = nodes_.at(indexes.back()).children;
+    auto child = children.find(*component);
+    if (child == children.end())
+      return;
+    indexes.push_back(child->second);
+  }
+
+  auto& owners = nodes_.at(indexes.back()).owners;
+  for (auto owner = owners.begin(); owner != owners.end(); ++owner) {
+    if (owner->anime_id == anime_id && owner->key == key) {
+      owners.erase(owner);
+      break;
+    }
+  }
+
+  for (size_t i = indexes.size() - 1; i > 0; i--) {
+    Node& node = nodes_.at(indexes.at(i));
+    if (!node.owners.empty() || !node.children.empty())
+      break;
+    nodes_.at(indexes.at(i - 1)).children.erase(components.at(i - 1));
+    free_nodes_.push_back(indexes.at(i));
+  }
+}
+
+}  // namespace anime
@@ -0,0 +1,82 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_LIBRARY_ANIME_PATH_INDEX_H
+#define TAIGA_LIBRARY_ANIME_PATH_INDEX_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace anime {
+
+// Maps the folders and episode files of anime items to their IDs. Paths are
+// stored in a trie of their components, so that the owner of a path can be
+// found in a single pass over it, as can everything under a folder.
+class PathIndex {
+public:
+  // Positive keys are episode numbers
+  enum Key {
+    kKeyNextEpisode = -1,
+    kKeyFolder = 0
+  };
+
+  struct Owner {
+    int anime_id;
+    int key;
+  };
+
+  PathIndex();
+  ~PathIndex() {}
+
+  void Clear();
+  void Remove(int anime_id);
+  // An empty path removes the key
+  void Set(int anime_id, int key, const std::wstring& path);
+
+  // Returns an empty string if the key is not set
+  const std::wstring& GetPath(int anime_id, int key) const;
+
+  // Returns the owners of the path itself
+  bool Find(const std::wstring& path, std::vector<Owner>& owners) const;
+  // Returns the anime whose folder is the deepest one to contain the path
+  int FindFolder(const std::wstring& path) const;
+  // Returns the owners of the path and everything under it
+  void FindAll(const std::wstring& path, std::vector<Owner>& owners) const;
+
+private:
+  struct Node {
+    std::map<std::wstring, size_t> children;
+    std::vector<Owner> owners;
+  };
+
+  static void SplitPath(const std::wstring& path,
+                        std::vector<std::wstring>& components);
+  size_t FindNode(const std::wstring& path) const;
+  size_t NewNode();
+  void RemoveOwner(const std::wstring& path, int anime_id, int key);
+
+  std::deque<Node> nodes_;
+  std::vector<size_t> free_nodes_;
+  std::map<std::pair<int, int>, std::wstring> paths_;
+};
+
+}  // namespace anime
+
+#endif  // TAIGA_LIBRARY_ANIME_PATH_INDEX_H
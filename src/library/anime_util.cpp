@@ -171,8 +171,21 @@ bool PlayEpisode(int anime_id, int number) {
 
   std::wstring file_path;
 
+  // Check the file that the episode was last seen in
+  std::wstring episode_path = anime_item->GetAvailableEpisodes().GetPath(number);
+  if (!episode_path.empty()) {
+    if (FileExists(episode_path)) {
+      file_path = episode_path;
+    } else {
+      LOG(LevelDebug, L"File doesn't exist anymore.\n"
+                      L"Path: " + episode_path);
+      anime_item->SetEpisodeAvailability(number, false, L"");
+    }
+  }
+
   // Check saved episode path
-  if (number == anime_item->GetMyLastWatchedEpisode() + 1) {
+  if (file_path.empty() &&
+      number == anime_item->GetMyLastWatchedEpisode() + 1) {
     const std::wstring& next_episode_path = anime_item->GetNextEpisodePath();
     if (!next_episode_path.empty()) {
       if (FileExists(next_episode_path)) {
@@ -576,17 +589,10 @@ bool IsAllEpisodesAvailable(const Item& item) {
   if (item.GetEpisodeCount() == 0)
     return false;
 
-  int available_episode_count = item.GetAvailableEpisodeCount();
-  bool all_episodes_available = available_episode_count > 0;
-
-  for (int i = 1; i <= available_episode_count; i++) {
-    if (!item.IsEpisodeAvailable(i)) {
-      all_episodes_available = false;
-      break;
-    }
-  }
+  const AvailableEpisodes& available_episodes = item.GetAvailableEpisodes();
 
-  return all_episodes_available;
+  return available_episodes.size() > 0 &&
+         available_episodes.Count() == available_episodes.size();
 }
 
 bool IsEpisodeRange(const std::wstring& episode_number) {
@@ -714,6 +720,7 @@ void DecrementEpisode(int anime_id) {
   if (history_item && *history_item->episode == watched &&
       watched > anime_item->GetMyLastWatchedEpisode(false)) {
     history_item->enabled = false;
+    History.queue.InvalidateAnimeIndex();
     History.queue.RemoveDisabled();
   } else {
     ChangeEpisode(anime_id, watched - 1);
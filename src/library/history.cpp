@@ -16,6 +16,8 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <set>
+
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
@@ -37,13 +39,22 @@ class History History;
 HistoryItem::HistoryItem()
     : anime_id(anime::ID_UNKNOWN),
       enabled(true),
-      mode(0) {
+      mode(0),
+      sequence(0) {
 }
 
 HistoryQueue::HistoryQueue()
     : index(0),
       history(nullptr),
-      updating(false) {
+      updating(false),
+      batch_failed_(false),
+      next_sequence_(1),
+      anime_index_valid_(false) {
+}
+
+HistoryQueue::IndexEntry::IndexEntry() {
+  for (int i = 0; i < kQueueSearchLast; i++)
+    items[i] = -1;
 }
 
 void HistoryQueue::Add(HistoryItem& item, bool save) {
@@ -97,6 +108,7 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
 
   // Edit previous item with the same ID...
   bool add_new_item = true;
+  size_t item_index = items.size();
   if (!History.queue.updating) {
     foreach_r_(it, items) {
       if (it->anime_id == item.anime_id && it->enabled) {
@@ -124,6 +136,7 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
           if (!add_new_item) {
             it->mode = taiga::kHttpServiceUpdateLibraryEntry;
             it->time = (std::wstring)GetDate() + L" " + GetTime();
+            item_index = static_cast<size_t>(items.rend() - it) - 1;
           }
           break;
         }
@@ -134,8 +147,10 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
   if (add_new_item) {
     if (item.time.empty())
       item.time = (std::wstring)GetDate() + L" " + GetTime();
+    item.sequence = next_sequence_++;
     items.push_back(item);
   }
+  AddToAnimeIndex(item_index);
 
   if (anime && save) {
     // Save
@@ -163,25 +178,51 @@ void HistoryQueue::Add(HistoryItem& item, bool save) {
   }
 }
 
+// Maximum number of anime that are updated in a single batch
+const size_t kMaxBatchSize = 20;
+
+static void MergeAnimeValues(AnimeValues& values, const AnimeValues& other) {
+  if (other.episode)
+    values.episode = *other.episode;
+  if (other.status)
+    values.status = *other.status;
+  if (other.score)
+    values.score = *other.score;
+  if (other.date_start)
+    values.date_start = *other.date_start;
+  if (other.date_finish)
+    values.date_finish = *other.date_finish;
+  if (other.enable_rewatching)
+    values.enable_rewatching = *other.enable_rewatching;
+  if (other.rewatched_times)
+    values.rewatched_times = *other.rewatched_times;
+  if (other.tags)
+    values.tags = *other.tags;
+}
+
 void HistoryQueue::Check(bool automatic) {
-  if (items.empty())
+  if (items.empty() || updating)
     return;
 
-  if (!items[index].enabled) {
-    LOG(LevelDebug, L"Item is disabled, removing...");
-    Remove(index, true, true, false);
-    Check(automatic);
-    return;
+  bool removed_items = false;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (!items[i].enabled) {
+      LOG(LevelDebug, L"Item is disabled, removing...");
+    } else if (!AnimeDatabase.FindItem(items[i].anime_id)) {
+      LOG(LevelWarning, L"Item not found in list, removing... ID: " +
+                        ToWstr(items[i].anime_id));
+    } else {
+      continue;
+    }
+    Remove(static_cast<int>(i--), false, false, false);
+    removed_items = true;
   }
-
-  auto anime_item = AnimeDatabase.FindItem(items[index].anime_id);
-  if (!anime_item) {
-    LOG(LevelWarning, L"Item not found in list, removing... ID: " +
-                      ToWstr(items[index].anime_id));
-    Remove(index, true, true, false);
-    Check(automatic);
-    return;
+  if (removed_items) {
+    history->Save();
+    ui::OnHistoryChange();
   }
+  if (items.empty())
+    return;
 
   if (automatic && !Settings.GetBool(taiga::kApp_Option_EnableSync)) {
     items[index].reason = L"Automatic synchronization is disabled";
@@ -194,17 +235,77 @@ void HistoryQueue::Check(bool automatic) {
     return;
   }
 
-  History.queue.updating = true;
-  ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
+  // Consecutive updates of an anime are coalesced into a single request.
+  // Additions and deletions are sent on their own, and the items that follow
+  // them wait for the next batch.
+  struct BatchItem {
+    int anime_id;
+    int mode;
+    std::vector<unsigned int> sequences;
+    AnimeValues values;
+  };
+  std::vector<BatchItem> batch_items;
+  std::map<int, size_t> batch_indexes;
+  std::set<int> waiting_anime;
+  foreach_(it, items) {
+    if (waiting_anime.count(it->anime_id))
+      continue;
+    auto batch_index = batch_indexes.find(it->anime_id);
+    if (batch_index == batch_indexes.end()) {
+      if (batch_items.size() == kMaxBatchSize) {
+        waiting_anime.insert(it->anime_id);
+        continue;
+      }
+      BatchItem batch_item;
+      batch_item.anime_id = it->anime_id;
+      batch_item.mode = it->mode;
+      batch_index = batch_indexes.insert(
+          std::make_pair(it->anime_id, batch_items.size())).first;
+      batch_items.push_back(batch_item);
+    } else if (it->mode != taiga::kHttpServiceUpdateLibraryEntry ||
+               batch_items[batch_index->second].mode !=
+                   taiga::kHttpServiceUpdateLibraryEntry) {
+      waiting_anime.insert(it->anime_id);
+      continue;
+    }
+    BatchItem& batch_item = batch_items[batch_index->second];
+    MergeAnimeValues(batch_item.values, *it);
+    batch_item.sequences.push_back(it->sequence);
+  }
+
+  foreach_(batch_item, batch_items) {
+    BatchEntry& entry = batch_[batch_item->anime_id];
+    entry.sequences = batch_item->sequences;
+    static_cast<AnimeValues&>(entry.values) = batch_item->values;
+    entry.values.anime_id = batch_item->anime_id;
+    entry.values.mode = batch_item->mode;
+  }
+
+  updating = true;
+  batch_failed_ = false;
+
+  if (batch_items.size() == 1) {
+    auto anime_item = AnimeDatabase.FindItem(batch_items.front().anime_id);
+    ui::ChangeStatusText(L"Updating list... (" + anime_item->GetTitle() + L")");
+  } else {
+    ui::ChangeStatusText(L"Updating list... (" +
+                         ToWstr(static_cast<int>(batch_items.size())) +
+                         L" items)");
+  }
 
-  AnimeValues* anime_values = static_cast<AnimeValues*>(&items[index]);
-  sync::UpdateLibraryEntry(*anime_values, items[index].anime_id,
-      static_cast<taiga::HttpClientMode>(items[index].mode));
+  // The connection manager sends these in parallel, up to its limit of
+  // connections per host
+  foreach_(batch_item, batch_items) {
+    sync::UpdateLibraryEntry(batch_item->values, batch_item->anime_id,
+        static_cast<taiga::HttpClientMode>(batch_item->mode));
+  }
 }
 
 void HistoryQueue::Clear(bool save) {
   items.clear();
   index = 0;
+  anime_index_.clear();
+  anime_index_valid_ = true;
 
   ui::OnHistoryChange();
 
@@ -213,55 +314,28 @@ void HistoryQueue::Clear(bool save) {
 }
 
 HistoryItem* HistoryQueue::FindItem(int anime_id, int search_mode) {
-  for (auto it = items.rbegin(); it != items.rend(); ++it) {
-    if (it->anime_id == anime_id && it->enabled) {
-      switch (search_mode) {
-        // Date
-        case kQueueSearchDateStart:
-          if (it->date_start)
-            return &(*it);
-          break;
-        case kQueueSearchDateEnd:
-          if (it->date_finish)
-            return &(*it);
-          break;
-        // Episode
-        case kQueueSearchEpisode:
-          if (it->episode)
-            return &(*it);
-          break;
-        // Rewatched times
-        case kQueueSearchRewatchedTimes:
-          if (it->rewatched_times)
-            return &(*it);
-          break;
-        // Rewatching
-        case kQueueSearchRewatching:
-          if (it->enable_rewatching)
-            return &(*it);
-          break;
-        // Score
-        case kQueueSearchScore:
-          if (it->score)
-            return &(*it);
-          break;
-        // Status
-        case kQueueSearchStatus:
-          if (it->status)
-            return &(*it);
-          break;
-        // Tags
-        case kQueueSearchTags:
-          if (it->tags)
-            return &(*it);
-          break;
-        // Default
-        default:
-          return &(*it);
-      }
-    }
+  if (!anime_index_valid_)
+    RebuildAnimeIndex();
+
+  auto entry = anime_index_.find(anime_id);
+  if (entry == anime_index_.end())
+    return nullptr;
+
+  if (search_mode < 0 || search_mode >= kQueueSearchLast)
+    search_mode = 0;
+  int item_index = entry->second.items[search_mode];
+
+  if (item_index < 0)
+    return nullptr;
+
+  // Items that were disabled without invalidating the index are skipped. They
+  // might be kept in the queue for a while, e.g. while they're being updated.
+  if (!items.at(item_index).enabled) {
+    RebuildAnimeIndex();
+    return FindItem(anime_id, search_mode);
   }
-  return nullptr;
+
+  return &items.at(item_index);
 }
 
 HistoryItem* HistoryQueue::GetCurrentItem() {
@@ -297,6 +371,7 @@ void HistoryQueue::Remove(int index, bool save, bool refresh, bool to_history) {
     }
 
     items.erase(history_item);
+    InvalidateAnimeIndex();
 
     if (refresh)
       ui::OnHistoryChange();
@@ -310,8 +385,10 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
   bool needs_refresh = false;
 
   for (size_t i = 0; i < items.size(); i++) {
-    if (!items.at(i).enabled) {
+    // Items that are being updated are removed once the update is complete
+    if (!items.at(i).enabled && !IsBatchItem(items.at(i))) {
       items.erase(items.begin() + i);
+      InvalidateAnimeIndex();
       needs_refresh = true;
       i--;
     }
@@ -324,6 +401,132 @@ void HistoryQueue::RemoveDisabled(bool save, bool refresh) {
     history->Save();
 }
 
+void HistoryQueue::HandleUpdate(int anime_id) {
+  auto it = batch_.find(anime_id);
+  if (it == batch_.end())
+    return;
+
+  BatchEntry entry = it->second;
+  batch_.erase(it);
+
+  // The values that were sent are applied even if the items were disabled or
+  // removed in the meantime, so that the list doesn't diverge from the server
+  AnimeDatabase.UpdateItem(entry.values);
+
+  foreach_(sequence, entry.sequences) {
+    int item_index = FindItemIndex(*sequence);
+    if (item_index > -1)
+      Remove(item_index, false, false, true);
+  }
+
+  if (batch_.empty())
+    FinishBatch();
+}
+
+void HistoryQueue::HandleUpdateError(int anime_id, const std::wstring& error) {
+  auto it = batch_.find(anime_id);
+  if (it == batch_.end())
+    return;
+
+  BatchEntry entry = it->second;
+  batch_.erase(it);
+  batch_failed_ = true;
+
+  // Items are kept in the queue to be sent again later
+  foreach_(sequence, entry.sequences) {
+    int item_index = FindItemIndex(*sequence);
+    if (item_index > -1)
+      items.at(item_index).reason = error;
+  }
+
+  if (batch_.empty())
+    FinishBatch();
+}
+
+void HistoryQueue::FinishBatch() {
+  updating = false;
+
+  AnimeDatabase.SaveList();
+  history->Save();
+  ui::OnHistoryChange();
+
+  // Failed items are sent again the next time the queue is checked
+  if (!batch_failed_) {
+    ui::ClearStatusText();
+    Check(false);
+  }
+}
+
+bool HistoryQueue::IsBatchItem(const HistoryItem& item) const {
+  auto it = batch_.find(item.anime_id);
+  if (it == batch_.end())
+    return false;
+
+  foreach_c_(sequence, it->second.sequences)
+    if (*sequence == item.sequence)
+      return true;
+
+  return false;
+}
+
+// Items may be removed or reordered while they're being updated, so they're
+// found by their sequence numbers rather than their positions
+int HistoryQueue::FindItemIndex(unsigned int sequence) const {
+  for (size_t i = 0; i < items.size(); i++)
+    if (items.at(i).sequence == sequence)
+      return static_cast<int>(i);
+
+  return -1;
+}
+
+void HistoryQueue::InvalidateAnimeIndex() {
+  anime_index_valid_ = false;
+}
+
+// Items that are added later override the values of earlier ones. Changes can
+// be merged into an earlier item than the last one of its anime (e.g. when the
+// last one adds or deletes the entry), so indexes are only ever moved forward.
+void HistoryQueue::AddToAnimeIndex(size_t item_index) {
+  if (!anime_index_valid_ || item_index >= items.size())
+    return;
+
+  const HistoryItem& item = items.at(item_index);
+  if (!item.enabled)
+    return;
+
+  auto& entry = anime_index_[item.anime_id];
+  int value = static_cast<int>(item_index);
+  auto update = [&](int search_mode) {
+    entry.items[search_mode] = max(entry.items[search_mode], value);
+  };
+
+  update(0);
+  if (item.date_start)
+    update(kQueueSearchDateStart);
+  if (item.date_finish)
+    update(kQueueSearchDateEnd);
+  if (item.episode)
+    update(kQueueSearchEpisode);
+  if (item.rewatched_times)
+    update(kQueueSearchRewatchedTimes);
+  if (item.enable_rewatching)
+    update(kQueueSearchRewatching);
+  if (item.score)
+    update(kQueueSearchScore);
+  if (item.status)
+    update(kQueueSearchStatus);
+  if (item.tags)
+    update(kQueueSearchTags);
+}
+
+void HistoryQueue::RebuildAnimeIndex() {
+  anime_index_.clear();
+  anime_index_valid_ = true;
+
+  for (size_t i = 0; i < items.size(); i++)
+    AddToAnimeIndex(i);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 History::History()
@@ -343,6 +546,7 @@ void History::Clear(bool save) {
 bool History::Load() {
   items.clear();
   queue.items.clear();
+  queue.InvalidateAnimeIndex();
 
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathUserHistory);
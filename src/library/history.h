@@ -19,8 +19,10 @@
 #ifndef TAIGA_LIBRARY_HISTORY_H
 #define TAIGA_LIBRARY_HISTORY_H
 
+#include <map>
 #include <string>
 #include <queue>
+#include <unordered_map>
 #include <vector>
 
 #include "base/optional.h"
@@ -36,7 +38,8 @@ enum QueueSearchMode {
   kQueueSearchRewatching,
   kQueueSearchScore,
   kQueueSearchStatus,
-  kQueueSearchTags
+  kQueueSearchTags,
+  kQueueSearchLast
 };
 
 class AnimeValues {
@@ -61,6 +64,7 @@ public:
   int mode;
   std::wstring reason;
   std::wstring time;
+  unsigned int sequence;  // Identifies the item while it's in the queue
 };
 
 class History;
@@ -79,10 +83,45 @@ public:
   void Remove(int index = -1, bool save = true, bool refresh = true, bool to_history = true);
   void RemoveDisabled(bool save = true, bool refresh = true);
 
+  void HandleUpdate(int anime_id);
+  void HandleUpdateError(int anime_id, const std::wstring& error);
+
+  // Must be called after items are modified directly
+  void InvalidateAnimeIndex();
+
   size_t index;
   std::vector<HistoryItem> items;
   History* history;
   bool updating;
+
+private:
+  void FinishBatch();
+  bool IsBatchItem(const HistoryItem& item) const;
+  int FindItemIndex(unsigned int sequence) const;
+
+  void AddToAnimeIndex(size_t item_index);
+  void RebuildAnimeIndex();
+
+  // Items that are being updated for each anime, and the values that were sent
+  // for them. Updates of different anime are sent together, and the list is
+  // saved once they are all complete.
+  class BatchEntry {
+  public:
+    std::vector<unsigned int> sequences;
+    HistoryItem values;
+  };
+  std::map<int, BatchEntry> batch_;
+  bool batch_failed_;
+  unsigned int next_sequence_;
+
+  // Index of the last enabled item of each anime, for each search mode
+  // (0 for any item), so that FindItem doesn't have to scan the queue
+  struct IndexEntry {
+    IndexEntry();
+    int items[kQueueSearchLast];
+  };
+  std::unordered_map<int, IndexEntry> anime_index_;
+  bool anime_index_valid_;
 };
 
 class History {
@@ -163,7 +163,7 @@ void Manager::HandleError(Response& response, HttpResponse& http_response) {
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry:
-      History.queue.updating = false;
+      History.queue.HandleUpdateError(anime_id, response.data[L"error"]);
       ui::OnLibraryUpdateFailure(anime_id, response.data[L"error"]);
       break;
     default:
@@ -231,13 +231,7 @@ void Manager::HandleResponse(Response& response, HttpResponse& http_response) {
     case kAddLibraryEntry:
     case kDeleteLibraryEntry:
     case kUpdateLibraryEntry: {
-      History.queue.updating = false;
-      ui::ClearStatusText();
-
-      auto history_item = History.queue.GetCurrentItem();
-      if (history_item)
-        AnimeDatabase.UpdateItem(*history_item);
-
+      History.queue.HandleUpdate(anime_id);
       break;
     }
   }
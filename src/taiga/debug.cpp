@@ -16,9 +16,24 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <libmojibake/mojibake.h>
+
+#include "base/foreach.h"
+#include "base/log.h"
 #include "base/string.h"
+#include "base/xml.h"
 #include "library/anime_db.h"
+#include "library/anime_episode.h"
+#include "sync/sync.h"
 #include "taiga/debug.h"
+#include "taiga/path.h"
+#include "track/feed.h"
+#include "track/recognition.h"
 #include "ui/dlg/dlg_main.h"
 #include "ui/dialog.h"
 
@@ -40,7 +55,7 @@ void Tester::Start() {
   value_ = li.QuadPart;
 }
 
-void Tester::End(std::wstring str, bool display_result) {
+double Tester::End(std::wstring str, bool display_result) {
   LARGE_INTEGER li;
 
   ::QueryPerformanceCounter(&li);
@@ -50,6 +65,8 @@ void Tester::End(std::wstring str, bool display_result) {
     str = ToWstr(value, 2) + L"ms | Text: [" + str + L"]";
     ui::DlgMain.SetText(str);
   }
+
+  return value;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -62,6 +79,452 @@ void Print(std::wstring text) {
 #endif
 }
 
+namespace {
+
+// The title normalization rules as they were applied before Normalizer, one
+// ReplaceString pass per rule. This is kept frozen as a reference for
+// TestNormalization, and should not be updated along with Normalizer.
+namespace legacy {
+
+struct WordRule {
+  const wchar_t* word;
+  const wchar_t* replacement;
+};
+
+const WordRule kRomanNumbers[] = {
+  {L"II", L"2"}, {L"III", L"3"}, {L"IV", L"4"}, {L"V", L"5"},
+  {L"VI", L"6"}, {L"VII", L"7"}, {L"VIII", L"8"}, {L"IX", L"9"},
+  {L"XI", L"11"}, {L"XII", L"12"}, {L"XIII", L"13"},
+};
+
+const WordRule kRomanizations[] = {
+  {L"wa", L"ha"}, {L"e", L"he"}, {L"o", L"wo"},
+};
+
+const WordRule kOrdinalNumbers[] = {
+  {L"first", L"1st"}, {L"second", L"2nd"}, {L"third", L"3rd"},
+  {L"fourth", L"4th"}, {L"fifth", L"5th"}, {L"sixth", L"6th"},
+  {L"seventh", L"7th"}, {L"eighth", L"8th"}, {L"ninth", L"9th"},
+};
+
+const int kSeasonPatternCount = 4;
+const wchar_t* const kSeasonNumbers[][kSeasonPatternCount] = {
+  {L"1", L"1st season", L"season 1", L"s1"},
+  {L"2", L"2nd season", L"season 2", L"s2"},
+  {L"3", L"3rd season", L"season 3", L"s3"},
+  {L"4", L"4th season", L"season 4", L"s4"},
+  {L"5", L"5th season", L"season 5", L"s5"},
+  {L"6", L"6th season", L"season 6", L"s6"},
+};
+
+const WordRule kUnnecessaryWords[] = {
+  {L"&", L"and"}, {L"the", L""}, {L"episode", L""}, {L"specials", L"special"},
+};
+
+const int kUnicodeOptions =
+    UTF8PROC_COMPAT | UTF8PROC_COMPOSE | UTF8PROC_STABLE |
+    UTF8PROC_IGNORE | UTF8PROC_STRIPCC | UTF8PROC_STRIPMARK |
+    UTF8PROC_LUMP |
+    UTF8PROC_CASEFOLD;
+
+bool IsPunctuation(wchar_t c) {
+  if (c <= 255 && !isalnum(c))
+    return true;
+  if (c > 8192 && c < 10087)
+    return true;
+  return false;
+}
+
+void ConvertOrdinalNumbers(std::wstring& str) {
+  for (const auto& ordinal : kOrdinalNumbers)
+    ReplaceString(str, 0, ordinal.word, ordinal.replacement, true, true);
+}
+
+void ConvertRomanNumbers(std::wstring& str) {
+  for (const auto& numeral : kRomanNumbers)
+    ReplaceString(str, 0, numeral.word, numeral.replacement, true, true);
+}
+
+void ConvertSeasonNumbers(std::wstring& str) {
+  for (const auto& value : kSeasonNumbers)
+    for (int i = 1; i < kSeasonPatternCount; ++i)
+      ReplaceString(str, 0, value[i], value[0], true, true);
+}
+
+void Transliterate(std::wstring& str) {
+  for (size_t i = 0; i < str.size(); ++i) {
+    auto& c = str[i];
+    switch (c) {
+      case L'\u00D7': c = L'x'; break;
+      case L'\u014C': str.replace(i, 1, L"ou"); break;
+      case L'\u014D': str.replace(i, 1, L"ou"); break;
+      case L'\u016B': str.replace(i, 1, L"uu"); break;
+    }
+  }
+
+  for (const auto& romanization : kRomanizations)
+    ReplaceString(str, 0, romanization.word, romanization.replacement, true, true);
+}
+
+void NormalizeUnicode(std::wstring& str) {
+  char* buffer = nullptr;
+  std::string temp = WstrToStr(str);
+
+  int length = utf8proc_map(
+      reinterpret_cast<const uint8_t*>(temp.data()), temp.length(),
+      reinterpret_cast<uint8_t**>(&buffer), kUnicodeOptions);
+
+  if (length >= 0) {
+    temp.assign(buffer, length);
+    str = StrToWstr(temp);
+  }
+
+  if (buffer)
+    free(buffer);
+}
+
+void EraseUnnecessary(std::wstring& str) {
+  for (const auto& word : kUnnecessaryWords)
+    ReplaceString(str, 0, word.word, word.replacement, true, true);
+}
+
+void ErasePunctuation(std::wstring& str) {
+  auto it = std::remove_if(str.begin(), str.end(), IsPunctuation);
+
+  if (it != str.end())
+    str.resize(std::distance(str.begin(), it));
+}
+
+void Normalize(std::wstring& title) {
+  ConvertRomanNumbers(title);
+  Transliterate(title);
+  NormalizeUnicode(title);  // Title is lower case after this point
+  ConvertOrdinalNumbers(title);
+  ConvertSeasonNumbers(title);
+  EraseUnnecessary(title);
+  ErasePunctuation(title);
+}
+
+}  // namespace legacy
+
+}  // namespace
+
+// Compares the compiled title normalizer with the legacy rule chain, over the
+// titles in the recognition test file and the anime database.
+void TestNormalization() {
+  std::vector<std::wstring> titles;
+
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathTestRecognition);
+  if (document.load_file(path.c_str()).status == pugi::status_ok) {
+    xml_node recognition = document.child(L"recognition");
+    foreach_xmlnode_(file_node, recognition, L"file")
+      titles.push_back(XmlReadStrValue(file_node, L"title"));
+  }
+
+  foreach_(it, AnimeDatabase.items) {
+    titles.push_back(it->second.GetTitle());
+    titles.push_back(it->second.GetEnglishTitle());
+    auto synonyms = it->second.GetSynonyms();
+    titles.insert(titles.end(), synonyms.begin(), synonyms.end());
+  }
+
+  if (titles.empty())
+    return;
+
+  const int iterations = 10;
+  track::recognition::Normalizer normalizer;
+  track::recognition::Normalizer::Buffer buffer;
+  std::vector<std::wstring> legacy_titles, compiled_titles;
+  Tester test;
+
+  test.Start();
+  for (int i = 0; i < iterations; i++) {
+    legacy_titles = titles;
+    foreach_(title, legacy_titles)
+      legacy::Normalize(*title);
+  }
+  double legacy_time = test.End(L"", false);
+
+  test.Start();
+  for (int i = 0; i < iterations; i++) {
+    compiled_titles = titles;
+    foreach_(title, compiled_titles)
+      normalizer.Normalize(*title, buffer);
+  }
+  double compiled_time = test.End(L"", false);
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < titles.size(); i++) {
+    if (legacy_titles[i] != compiled_titles[i]) {
+      LOG(LevelDebug, L"Mismatch: \"" + titles[i] + L"\" -> \"" +
+                      legacy_titles[i] + L"\" / \"" + compiled_titles[i] + L"\"");
+      mismatches++;
+    }
+  }
+
+  std::wstring result = L"Normalized " + ToWstr(static_cast<int>(titles.size())) +
+                        L" titles x" + ToWstr(iterations) +
+                        L" | Legacy: " + ToWstr(legacy_time, 2) + L"ms" +
+                        L" | Compiled: " + ToWstr(compiled_time, 2) + L"ms" +
+                        L" | Mismatches: " + ToWstr(static_cast<int>(mismatches));
+  LOG(LevelDebug, result);
+  ui::DlgMain.SetText(result);
+}
+
+// Compares CaseInsensitiveSearcher with InStr, searching feed titles for the
+// values of feed filter conditions and the words of anime titles.
+void TestStringSearch() {
+  std::vector<std::wstring> titles;
+
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathTestRecognition);
+  if (document.load_file(path.c_str()).status == pugi::status_ok) {
+    xml_node recognition = document.child(L"recognition");
+    foreach_xmlnode_(file_node, recognition, L"file")
+      titles.push_back(XmlReadStrValue(file_node, L"file"));
+  }
+  foreach_(feed, Aggregator.feeds)
+    foreach_(item, feed->items)
+      titles.push_back(item->title);
+
+  std::vector<std::wstring> words;
+  foreach_(filter, Aggregator.filter_manager.filters)
+    foreach_(condition, filter->conditions)
+      if (condition->value.find(L'%') == std::wstring::npos)
+        words.push_back(condition->value);
+  foreach_(it, AnimeDatabase.items) {
+    std::vector<std::wstring> title_words;
+    Split(it->second.GetTitle(), L" ", title_words);
+    words.insert(words.end(), title_words.begin(), title_words.end());
+    if (words.size() > 1000)
+      break;
+  }
+  RemoveEmptyStrings(words);
+
+  if (titles.empty() || words.empty())
+    return;
+
+  std::vector<CaseInsensitiveSearcher> searchers;
+  foreach_(word, words)
+    searchers.push_back(CaseInsensitiveSearcher(*word));
+
+  std::vector<int> legacy_results, searcher_results;
+  legacy_results.reserve(titles.size() * words.size());
+  searcher_results.reserve(titles.size() * words.size());
+  Tester test;
+
+  test.Start();
+  foreach_(word, words)
+    foreach_(title, titles)
+      legacy_results.push_back(InStr(*title, *word, 0, true));
+  double legacy_time = test.End(L"", false);
+
+  test.Start();
+  foreach_(searcher, searchers)
+    foreach_(title, titles)
+      searcher_results.push_back(searcher->Find(*title));
+  double searcher_time = test.End(L"", false);
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < legacy_results.size(); i++)
+    if (legacy_results[i] != searcher_results[i])
+      mismatches++;
+
+  std::wstring result = L"Searched " + ToWstr(static_cast<int>(titles.size())) +
+                        L" titles for " + ToWstr(static_cast<int>(words.size())) +
+                        L" words | InStr: " + ToWstr(legacy_time, 2) + L"ms" +
+                        L" | Searcher: " + ToWstr(searcher_time, 2) + L"ms" +
+                        L" | Mismatches: " + ToWstr(static_cast<int>(mismatches));
+  LOG(LevelDebug, result);
+  ui::DlgMain.SetText(result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct RecognitionField {
+  const wchar_t* name;
+  std::wstring anime::Episode::* value;
+};
+
+const RecognitionField kRecognitionFields[] = {
+  {L"title", &anime::Episode::title},
+  {L"number", &anime::Episode::number},
+  {L"group", &anime::Episode::group},
+  {L"checksum", &anime::Episode::checksum},
+  {L"resolution", &anime::Episode::resolution},
+  {L"version", &anime::Episode::version},
+  {L"audio", &anime::Episode::audio_type},
+  {L"video", &anime::Episode::video_type},
+  {L"extra", &anime::Episode::extras},
+  {L"name", &anime::Episode::name},
+  {L"format", &anime::Episode::format},
+};
+
+void PrintReport(const std::wstring& text) {
+  LOG(LevelInformational, text);
+
+  // Write to the console of the parent process, if there is one
+  static bool attached = ::AttachConsole(ATTACH_PARENT_PROCESS) != FALSE;
+  if (attached) {
+    std::wstring line = text + L"\r\n";
+    DWORD written = 0;
+    ::WriteConsole(::GetStdHandle(STD_OUTPUT_HANDLE), line.c_str(),
+                   static_cast<DWORD>(line.size()), &written, nullptr);
+  }
+}
+
+}  // namespace
+
+int TestRecognition(int iterations) {
+  iterations = max(iterations, 1);
+
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathTestRecognition);
+  if (document.load_file(path.c_str()).status != pugi::status_ok) {
+    PrintReport(L"Could not read recognition test file: " + path);
+    return -1;
+  }
+
+  // Expected values, and a synthetic database that consists of an item for
+  // each expected title
+  std::vector<anime::Episode> expected_episodes;
+  std::map<std::wstring, int> anime_ids;
+  xml_node recognition = document.child(L"recognition");
+  foreach_xmlnode_(file_node, recognition, L"file") {
+    anime::Episode episode;
+    episode.file = XmlReadStrValue(file_node, L"file");
+    for (const auto& field : kRecognitionFields)
+      episode.*(field.value) = XmlReadStrValue(file_node, field.name);
+    auto& anime_id = anime_ids[episode.title];
+    if (!anime_id) {
+      anime_id = static_cast<int>(anime_ids.size());
+      auto& anime_item = AnimeDatabase.items[anime_id];
+      anime_item.SetId(ToWstr(anime_id), sync::kTaiga);
+      anime_item.SetTitle(episode.title);
+    }
+    episode.anime_id = anime_id;
+    expected_episodes.push_back(episode);
+  }
+
+  if (expected_episodes.empty()) {
+    PrintReport(L"Recognition test file is empty: " + path);
+    return -1;
+  }
+
+  const size_t field_count = sizeof(kRecognitionFields) / sizeof(*kRecognitionFields);
+  std::vector<size_t> field_successes(field_count);
+  size_t identified_count = 0;
+  std::set<std::wstring> passed_files;
+  std::vector<double> latencies;
+  track::recognition::MatchOptions match_options;
+  Tester test;
+
+  for (int i = 0; i < iterations; i++) {
+    foreach_c_(expected, expected_episodes) {
+      anime::Episode episode;
+      test.Start();
+      Meow.Parse(expected->file, episode);
+      Meow.Identify(episode, true, match_options);
+      latencies.push_back(test.End(L"", false));
+
+      // Results don't change between iterations
+      if (i > 0)
+        continue;
+
+      bool passed = true;
+      for (size_t j = 0; j < field_count; j++) {
+        auto value = kRecognitionFields[j].value;
+        if (episode.*value == expected->*value) {
+          field_successes[j]++;
+        } else {
+          passed = false;
+        }
+      }
+      if (episode.anime_id == expected->anime_id) {
+        identified_count++;
+      } else {
+        passed = false;
+      }
+      if (passed)
+        passed_files.insert(expected->file);
+    }
+  }
+
+  auto percentage = [&](size_t count) {
+    return ToWstr(static_cast<int>(count)) + L"/" +
+           ToWstr(static_cast<int>(expected_episodes.size())) + L" (" +
+           ToWstr(count * 100.0 / expected_episodes.size(), 2) + L"%)";
+  };
+
+  PrintReport(L"Recognition test: " + ToWstr(static_cast<int>(expected_episodes.size())) +
+              L" files, " + ToWstr(iterations) + L" iteration(s)");
+  for (size_t j = 0; j < field_count; j++)
+    PrintReport(std::wstring(L"  ") + kRecognitionFields[j].name + L": " +
+                percentage(field_successes[j]));
+  PrintReport(L"  anime_id: " + percentage(identified_count));
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](size_t p) {
+      return latencies[min(latencies.size() * p / 100, latencies.size() - 1)];
+    };
+    PrintReport(L"  Latency: p50 " + ToWstr(percentile(50), 3) + L"ms, p99 " +
+                ToWstr(percentile(99), 3) + L"ms");
+  }
+
+  // Files that passed in a previous run must still pass. The baseline is only
+  // updated when there are no regressions, so that it never gets worse.
+  std::vector<std::wstring> baseline_files;
+  xml_document baseline_document;
+  std::wstring baseline_path = taiga::GetPath(taiga::kPathTestRecognitionBaseline);
+  if (baseline_document.load_file(baseline_path.c_str()).status == pugi::status_ok) {
+    xml_node baseline_node = baseline_document.child(L"baseline");
+    XmlReadChildNodes(baseline_node, baseline_files, L"file");
+  }
+
+  int regressions = 0;
+  foreach_c_(file, baseline_files) {
+    if (passed_files.find(*file) == passed_files.end()) {
+      PrintReport(L"  Regression: " + *file);
+      regressions++;
+    }
+  }
+
+  if (regressions == 0) {
+    xml_document new_document;
+    xml_node baseline_node = new_document.append_child(L"baseline");
+    XmlWriteChildNodes(baseline_node,
+                       std::vector<std::wstring>(passed_files.begin(), passed_files.end()),
+                       L"file");
+    XmlWriteDocumentToFile(new_document, baseline_path);
+  }
+
+  PrintReport(L"  Regressions: " + ToWstr(regressions));
+
+  return regressions;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void PrintIndexSize() {
+  auto size = Meow.GetIndexSize();
+
+  std::wstring text = L"Recognition index | Anime: " + ToWstr(static_cast<int>(size.anime)) +
+      L" | Titles: " + ToWstr(static_cast<int>(size.titles)) +
+      L" | Title entries: " + ToWstr(static_cast<int>(size.title_entries)) +
+      L" (" + ToWstr(static_cast<int>(size.title_ids)) + L" IDs)" +
+      L" | Normal title entries: " + ToWstr(static_cast<int>(size.normal_title_entries)) +
+      L" (" + ToWstr(static_cast<int>(size.normal_title_ids)) + L" IDs)" +
+      L" | Trigram titles: " + ToWstr(static_cast<int>(size.trigram_titles)) +
+      L" | Trigrams: " + ToWstr(static_cast<int>(size.trigrams)) +
+      L" (" + ToWstr(static_cast<int>(size.trigram_postings)) + L" postings)";
+
+  LOG(LevelDebug, text);
+}
+
 void Test() {
   // Define variables
   std::wstring str;
@@ -79,6 +542,11 @@ void Test() {
     //      O RLY?
   }
 
+  // Benchmark title normalization and string search
+  TestNormalization();
+  TestStringSearch();
+  PrintIndexSize();
+
   // Debug recognition engine
   ui::ShowDialog(ui::kDialogTestRecognition);
 
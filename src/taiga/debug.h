@@ -28,7 +28,7 @@ class Tester {
   Tester();
 
   void Start();
-  void End(std::wstring str, bool display_result);
+  double End(std::wstring str, bool display_result);
 
  private:
   double frequency_;
@@ -36,6 +36,14 @@ class Tester {
 };
 
 void Print(std::wstring text);
+void PrintIndexSize();
+void TestNormalization();
+void TestStringSearch();
+
+// Parses and identifies each file in the recognition test data, without the
+// user's database or any windows. Writes a report to the log and the parent
+// console, and returns the number of files that passed before but not now.
+int TestRecognition(int iterations);
 void Test();
 
 }  // namespace debug
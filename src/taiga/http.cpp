@@ -155,6 +155,21 @@ void HttpManager::HandleError(HttpResponse& response, const string_t& error) {
     case kHttpServiceUpdateLibraryEntry:
       ServiceManager.HandleHttpError(client.response_, error);
       break;
+
+    case kHttpFeedCheck:
+    case kHttpFeedCheckAuto: {
+      Feed* feed = reinterpret_cast<Feed*>(response.parameter);
+      if (feed)
+        Aggregator.HandleFeedCheckError(*feed, response);
+      break;
+    }
+    case kHttpFeedDownload:
+    case kHttpFeedDownloadAll: {
+      Feed* feed = reinterpret_cast<Feed*>(response.parameter);
+      if (feed)
+        Aggregator.HandleFeedDownloadError(*feed);
+      break;
+    }
   }
 
   FreeConnection(client.request_.url.host);
@@ -194,18 +209,21 @@ void HttpManager::HandleResponse(HttpResponse& response) {
       Feed* feed = reinterpret_cast<Feed*>(response.parameter);
       if (feed) {
         bool automatic = client.mode() == kHttpFeedCheckAuto;
-        Aggregator.HandleFeedCheck(*feed, client.write_buffer_, automatic);
+        Aggregator.HandleFeedCheck(*feed, response, client.write_buffer_,
+                                   automatic);
       }
       break;
     }
     case kHttpFeedDownload:
     case kHttpFeedDownloadAll: {
+      auto feed = reinterpret_cast<Feed*>(response.parameter);
       if (Aggregator.ValidateFeedDownload(client.request(), response)) {
-        auto feed = reinterpret_cast<Feed*>(response.parameter);
         if (feed) {
           bool download_all = client.mode() == kHttpFeedDownloadAll;
           Aggregator.HandleFeedDownload(*feed, client.write_buffer_, download_all);
         }
+      } else if (feed) {
+        Aggregator.HandleFeedDownloadError(*feed);
       }
       break;
     }
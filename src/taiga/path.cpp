@@ -56,14 +56,20 @@ std::wstring GetPath(PathType type) {
       return data_path + L"db\\";
     case kPathDatabaseAnime:
       return data_path + L"db\\anime.xml";
+    case kPathDatabaseAnimeSnapshot:
+      return data_path + L"db\\anime.dat";
     case kPathDatabaseImage:
       return data_path + L"db\\image\\";
+    case kPathDatabaseScanCache:
+      return data_path + L"db\\scan.xml";
     case kPathDatabaseSeason:
       return data_path + L"db\\season\\";
     case kPathFeed:
       return data_path + L"feed\\";
     case kPathFeedHistory:
       return data_path + L"feed\\history.xml";
+    case kPathFeedHistoryJournal:
+      return data_path + L"feed\\history.journal";
     case kPathMedia:
       return data_path + L"media.xml";
     case kPathSettings:
@@ -72,6 +78,8 @@ std::wstring GetPath(PathType type) {
       return data_path + L"test\\";
     case kPathTestRecognition:
       return data_path + L"test\\recognition.xml";
+    case kPathTestRecognitionBaseline:
+      return data_path + L"test\\recognition_baseline.xml";
     case kPathTheme:
       return data_path + L"theme\\";
     case kPathThemeCurrent:
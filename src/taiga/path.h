@@ -27,14 +27,18 @@ enum PathType {
   kPathData,
   kPathDatabase,
   kPathDatabaseAnime,
+  kPathDatabaseAnimeSnapshot,
   kPathDatabaseImage,
+  kPathDatabaseScanCache,
   kPathDatabaseSeason,
   kPathFeed,
   kPathFeedHistory,
+  kPathFeedHistoryJournal,
   kPathMedia,
   kPathSettings,
   kPathTest,
   kPathTestRecognition,
+  kPathTestRecognitionBaseline,
   kPathTheme,
   kPathThemeCurrent,
   kPathUser,
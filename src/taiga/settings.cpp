@@ -257,8 +257,16 @@ bool AppSettings::Load() {
   if (Aggregator.filter_manager.filters.empty())
     Aggregator.filter_manager.AddPresets();
   auto feed = Aggregator.Get(kFeedCategoryLink);
-  if (feed)
+  if (feed) {
     feed->link = GetWstr(kTorrent_Discovery_Source);
+    // Main source is followed by additional ones
+    std::vector<FeedSource> sources(1, FeedSource(feed->link));
+    xml_node node_sources = settings.child(L"rss").child(L"torrent").child(L"sources");
+    foreach_xmlnode_(source, node_sources, L"source")
+      sources.push_back(FeedSource(source.attribute(L"address").value(),
+                                   source.attribute(L"interval").as_int()));
+    feed->SetSources(sources);
+  }
   Aggregator.LoadArchive();
 
   return result.status == pugi::status_ok;
@@ -315,6 +323,18 @@ bool AppSettings::Save() {
   xml_node torrent_filter = settings.child(L"rss").child(L"torrent").child(L"filter");
   Aggregator.filter_manager.Export(torrent_filter, Aggregator.filter_manager.filters);
 
+  // Torrent sources
+  auto feed = Aggregator.Get(kFeedCategoryLink);
+  if (feed) {
+    xml_node torrent_sources = settings.child(L"rss").child(L"torrent").append_child(L"sources");
+    for (size_t i = 1; i < feed->sources.size(); i++) {
+      xml_node source = torrent_sources.append_child(L"source");
+      source.append_attribute(L"address") = feed->sources.at(i).address.c_str();
+      if (feed->sources.at(i).interval > 0)
+        source.append_attribute(L"interval") = feed->sources.at(i).interval;
+    }
+  }
+
   // Write to registry
   win::Registry reg;
   reg.OpenKey(HKEY_CURRENT_USER,
@@ -350,7 +370,7 @@ void AppSettings::ApplyChanges(const std::wstring& previous_service,
         Set(kSync_ActiveService, previous_service);
         AnimeDatabase.SaveList(true);
         Set(kSync_ActiveService, current_service);
-        AnimeDatabase.items.clear();
+        AnimeDatabase.ClearItems();
         ImageDatabase.Clear();
       } else {
         Set(kSync_ActiveService, previous_service);
@@ -384,6 +404,15 @@ void AppSettings::ApplyChanges(const std::wstring& previous_service,
   ui::Menus.UpdateExternalLinks();
   ui::Menus.UpdateFolders();
 
+  auto feed = Aggregator.Get(kFeedCategoryLink);
+  if (feed && !feed->sources.empty()) {
+    std::vector<FeedSource> sources;
+    foreach_(it, feed->sources)
+      sources.push_back(FeedSource(it->address, it->interval));
+    sources.front().address = GetWstr(kTorrent_Discovery_Source);
+    feed->SetSources(sources);
+  }
+
   timers.UpdateIntervalsFromSettings();
 }
 
@@ -23,6 +23,7 @@
 #include "library/history.h"
 #include "taiga/announce.h"
 #include "taiga/api.h"
+#include "taiga/debug.h"
 #include "taiga/dummy.h"
 #include "taiga/resource.h"
 #include "taiga/settings.h"
@@ -46,6 +47,7 @@ App::App()
     debug_mode(false),
 #endif
       logged_in(false),
+      test_recognition_iterations(0),
       current_tip_type(kTipTypeDefault),
       play_status(kPlayStatusStopped) {
 
@@ -71,6 +73,13 @@ BOOL App::InitInstance() {
   Logger.SetSeverityLevel(debug_mode ? LevelDebug : LevelWarning);
   LOG(LevelInformational, L"Version " + std::wstring(version));
 
+  // Run recognition tests without loading user data or creating any windows
+  if (test_recognition_iterations > 0) {
+    int regressions = debug::TestRecognition(test_recognition_iterations);
+    PostQuitMessage(regressions != 0 ? 1 : 0);
+    return TRUE;
+  }
+
   // Check another instance
   if (!allow_multiple_instances) {
     if (CheckInstance(L"Taiga-33d5a63c-de90-432f-9a8b-f6f733dab258",
@@ -141,6 +150,11 @@ void App::ParseCommandLineArguments() {
     } else if (argument == L"-allowmultipleinstances") {
       allow_multiple_instances = true;
       LOG(LevelDebug, argument);
+    } else if (argument == L"-testrecognition") {
+      // Optionally followed by the number of iterations
+      test_recognition_iterations = 1;
+      if (i + 1 < argument_count && IsNumeric(argument_list[i + 1]))
+        test_recognition_iterations = ToInt(std::wstring(argument_list[++i]));
     } else {
       LOG(LevelWarning, L"Invalid argument: " + argument);
     }
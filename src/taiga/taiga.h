@@ -58,6 +58,7 @@ public:
   int current_tip_type, play_status;
   bool debug_mode;
   bool logged_in;
+  int test_recognition_iterations;
   base::SemanticVersion version;
 
   class Updater : public UpdateHelper {
@@ -31,6 +31,7 @@
 #include "taiga/timer.h"
 #include "track/feed.h"
 #include "track/media.h"
+#include "track/monitor.h"
 #include "track/search.h"
 #include "ui/dlg/dlg_main.h"
 #include "ui/dlg/dlg_stats.h"
@@ -42,6 +43,7 @@ Timer timer_history(kTimerHistory, 5 * 60);     //  5 minutes
 Timer timer_library(kTimerLibrary, 30 * 60);    // 30 minutes
 Timer timer_media(kTimerMedia, 2 * 60, false);  //  2 minutes
 Timer timer_memory(kTimerMemory, 10 * 60);      // 10 minutes
+Timer timer_monitor(kTimerMonitor, 3, false);   //  3 seconds
 Timer timer_stats(kTimerStats, 10);             // 10 seconds
 Timer timer_torrents(kTimerTorrents, 60 * 60);  // 60 minutes
 
@@ -82,14 +84,25 @@ void Timer::OnTimeout() {
       ImageDatabase.FreeMemory();
       break;
 
+    case kTimerMonitor:
+      FolderMonitor.ProcessChanges();
+      break;
+
     case kTimerStats:
       Stats.CalculateAll();
       break;
 
-    case kTimerTorrents:
-      Aggregator.feeds.at(0).Check(
-          Settings[taiga::kTorrent_Discovery_Source], true);
+    case kTimerTorrents: {
+      auto feed = Aggregator.Get(kFeedCategoryLink);
+      if (feed) {
+        feed->CheckSources(true);
+        // Sources have their own intervals
+        int seconds = feed->GetTimeToNextCheck();
+        if (seconds > 0)
+          set_interval(seconds);
+      }
       break;
+    }
   }
 }
 
@@ -107,6 +120,7 @@ void TimerManager::Initialize() {
   InsertTimer(&timer_library);
   InsertTimer(&timer_media);
   InsertTimer(&timer_memory);
+  InsertTimer(&timer_monitor);
   InsertTimer(&timer_stats);
   InsertTimer(&timer_torrents);
 }
@@ -135,8 +149,13 @@ void TimerManager::UpdateIntervalsFromSettings() {
   timer_media.set_interval(
       Settings.GetInt(taiga::kSync_Update_Delay));
 
-  timer_torrents.set_interval(
-      Settings.GetInt(taiga::kTorrent_Discovery_AutoCheckInterval) * 60);
+  auto feed = Aggregator.Get(kFeedCategoryLink);
+  int torrents_interval = feed ? feed->GetTimeToNextCheck() : 0;
+  if (torrents_interval <= 0)
+    torrents_interval =
+        Settings.GetInt(taiga::kTorrent_Discovery_AutoCheckInterval) * 60;
+  timer_torrents.set_interval(torrents_interval);
+  timer_torrents.set_ticks(torrents_interval);
 }
 
 void TimerManager::UpdateUi() {
@@ -28,6 +28,7 @@ enum TimerIds {
   kTimerLibrary,
   kTimerMedia,
   kTimerMemory,
+  kTimerMonitor,
   kTimerStats,
   kTimerTorrents
 };
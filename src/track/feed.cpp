@@ -24,17 +24,22 @@
 #include "base/html.h"
 #include "base/log.h"
 #include "base/string.h"
+#include "base/time.h"
 #include "base/url.h"
 #include "base/xml.h"
 #include "library/anime_db.h"
 #include "library/anime_util.h"
 #include "taiga/http.h"
 #include "taiga/path.h"
+#include "taiga/script.h"
 #include "taiga/settings.h"
+#include "taiga/taiga.h"
 #include "track/feed.h"
+#include "track/feed_parser.h"
 #include "track/recognition.h"
 #include "ui/dialog.h"
 #include "ui/ui.h"
+#include "win/win_thread.h"
 
 class Aggregator Aggregator;
 
@@ -42,6 +47,15 @@ GenericFeedItem::GenericFeedItem()
     : permalink(true) {
 }
 
+std::wstring GenericFeedItem::GetIdentity() const {
+  // Same precedence as Aggregator::CompareFeedItems
+  if (permalink && !guid.empty())
+    return L"guid:" + guid;
+  if (!link.empty())
+    return L"link:" + link;
+  return L"title:" + title;
+}
+
 FeedItem::FeedItem()
     : index(-1),
       state(kFeedItemBlank) {
@@ -83,9 +97,153 @@ bool FeedItem::operator<(const FeedItem& item) const {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// Replaces line break tags and removes all other tags in a single pass. The
+// result is the same as replacing "<br/>" and "<br />" with new lines, and then
+// calling StripHtmlTags.
+static void ConvertHtmlTags(std::wstring& str) {
+  size_t pos = str.find(L'<');
+  if (pos == std::wstring::npos)
+    return;
+
+  auto get_line_break_length = [&str](size_t pos) -> size_t {
+    if (str.compare(pos, 5, L"<br/>") == 0)
+      return 5;
+    if (str.compare(pos, 6, L"<br />") == 0)
+      return 6;
+    return 0;
+  };
+
+  std::wstring output(str, 0, pos);
+  output.reserve(str.size());
+  bool strip_tags = true;
+
+  while (pos < str.size()) {
+    if (str.at(pos) != L'<') {
+      output.push_back(str.at(pos++));
+      continue;
+    }
+
+    size_t length = get_line_break_length(pos);
+    if (length) {
+      output.push_back(L'\n');
+      pos += length;
+      continue;
+    }
+
+    if (strip_tags) {
+      // Line breaks within the tag are removed along with it
+      size_t pos_end = pos + 1;
+      while (pos_end < str.size() && str.at(pos_end) != L'>') {
+        length = get_line_break_length(pos_end);
+        pos_end += length ? length : 1;
+      }
+      if (pos_end < str.size()) {
+        pos = pos_end + 1;
+        continue;
+      }
+      // There are no more tags to strip
+      strip_tags = false;
+    }
+
+    output.push_back(str.at(pos++));
+  }
+
+  str.swap(output);
+}
+
+// Writes the raw feed data to disk in the background
+class FeedDataWriter : public win::Thread {
+public:
+  void Write(const std::string& data, const std::wstring& path) {
+    // Wait for the previous write to complete
+    if (GetThreadHandle()) {
+      ::WaitForSingleObject(GetThreadHandle(), INFINITE);
+      CloseThreadHandle();
+    }
+
+    data_ = data;
+    path_ = path;
+
+    if (!CreateThread(nullptr, 0, 0))
+      ThreadProc();
+  }
+
+  DWORD ThreadProc() {
+    SaveToFile(data_, path_);
+    return 0;
+  }
+
+private:
+  std::string data_;
+  std::wstring path_;
+};
+
+static FeedDataWriter FeedDataWriter;
+
+static std::wstring GetFeedDataPath(const std::wstring& address) {
+  std::wstring path = taiga::GetPath(taiga::kPathFeed);
+
+  if (!address.empty()) {
+    Url url(address);
+    path += Base64Encode(url.host, true) + L"\\";
+  }
+
+  return path;
+}
+
+static void SwapFeedData(GenericFeed& feed1, GenericFeed& feed2) {
+  feed1.title.swap(feed2.title);
+  feed1.link.swap(feed2.link);
+  feed1.description.swap(feed2.description);
+  feed1.items.swap(feed2.items);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Sources that keep failing are checked less often, up to 2^n times their
+// usual interval
+const unsigned int kFeedSourceMaxBackoff = 3;
+
+FeedSource::FeedSource()
+    : interval(0),
+      loaded(false),
+      failure_count(0),
+      next_check(0) {
+}
+
+FeedSource::FeedSource(const std::wstring& address, int interval)
+    : address(address),
+      interval(interval),
+      loaded(false),
+      failure_count(0),
+      next_check(0) {
+}
+
+int FeedSource::GetInterval() const {
+  int minutes = interval > 0 ? interval :
+      Settings.GetInt(taiga::kTorrent_Discovery_AutoCheckInterval);
+  return minutes > 0 ? minutes * 60 : 0;
+}
+
+bool FeedSource::IsDue(time_t current_time) const {
+  return !address.empty() && request_uid.empty() &&
+         GetInterval() > 0 && next_check <= current_time;
+}
+
+void FeedSource::Schedule(time_t current_time) {
+  unsigned int backoff = failure_count < kFeedSourceMaxBackoff ?
+                         failure_count : kFeedSourceMaxBackoff;
+  next_check = current_time + (static_cast<time_t>(GetInterval()) << backoff);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 Feed::Feed()
     : category(kFeedCategoryLink),
-      download_index(-1) {
+      download_index(-1),
+      cached_revision_(0),
+      cached_title_signature_(0),
+      filter_signature_(0) {
 }
 
 bool Feed::Check(const std::wstring& source, bool automatic) {
@@ -94,6 +252,38 @@ bool Feed::Check(const std::wstring& source, bool automatic) {
 
   link = source;
 
+  // Results replace the items of all sources until the next check
+  search_source_ = FeedSource(source);
+
+  return CheckSource(search_source_, automatic);
+}
+
+bool Feed::CheckSources(bool automatic) {
+  time_t time_now = time(nullptr);
+  bool checking = false;
+
+  if (automatic)
+    notified_items_.clear();
+
+  // Search results are replaced
+  search_source_ = FeedSource();
+
+  // Each source is checked with a separate request, so that a slow server
+  // doesn't hold back the others
+  foreach_(it, sources) {
+    if (automatic ? !it->IsDue(time_now) : !it->request_uid.empty())
+      continue;
+    if (CheckSource(*it, automatic))
+      checking = true;
+  }
+
+  return checking;
+}
+
+bool Feed::CheckSource(FeedSource& source, bool automatic) {
+  if (source.address.empty())
+    return false;
+
   switch (category) {
     case kFeedCategoryLink:
       if (!automatic)
@@ -103,10 +293,21 @@ bool Feed::Check(const std::wstring& source, bool automatic) {
   }
 
   HttpRequest http_request;
-  http_request.url = link;
+  http_request.url = source.address;
   http_request.parameter = reinterpret_cast<LPARAM>(this);
   http_request.header[L"Accept-Encoding"] = L"gzip";
 
+  // Server can respond with "304 Not Modified" if we already have the data
+  if (source.loaded) {
+    if (!source.etag.empty())
+      http_request.header[L"If-None-Match"] = source.etag;
+    if (!source.last_modified.empty())
+      http_request.header[L"If-Modified-Since"] = source.last_modified;
+  }
+
+  source.request_uid = http_request.uid;
+  source.Schedule(time(nullptr));
+
   auto client_mode = automatic ?
       taiga::kHttpFeedCheckAuto : taiga::kHttpFeedCheck;
 
@@ -115,6 +316,102 @@ bool Feed::Check(const std::wstring& source, bool automatic) {
   return true;
 }
 
+FeedSource* Feed::FindSource(const std::wstring& request_uid) {
+  if (request_uid.empty())
+    return nullptr;
+
+  foreach_(it, sources)
+    if (it->request_uid == request_uid)
+      return &(*it);
+
+  if (search_source_.request_uid == request_uid)
+    return &search_source_;
+
+  return nullptr;
+}
+
+void Feed::MergeSources() {
+  std::vector<const FeedSource*> merged_sources;
+  if (search_source_.loaded) {
+    merged_sources.push_back(&search_source_);
+  } else {
+    foreach_(it, sources)
+      if (it->loaded)
+        merged_sources.push_back(&(*it));
+  }
+
+  title.clear();
+  link.clear();
+  description.clear();
+  items.clear();
+
+  // Items that were already read from a previous source are skipped. Releases
+  // are mirrored by many trackers, so items with the same title are assumed to
+  // be the same.
+  std::unordered_set<std::wstring> identities;
+  std::unordered_set<std::wstring> titles;
+
+  foreach_(source, merged_sources) {
+    if (source == merged_sources.begin()) {
+      title = (*source)->title;
+      link = (*source)->link;
+      description = (*source)->description;
+    }
+
+    size_t first_item = items.size();
+    foreach_c_(it, (*source)->items) {
+      if (identities.count(it->GetIdentity()) ||
+          (!it->title.empty() && titles.count(it->title)))
+        continue;
+      items.push_back(*it);
+    }
+
+    for (size_t i = first_item; i < items.size(); i++) {
+      identities.insert(items.at(i).GetIdentity());
+      if (!items.at(i).title.empty())
+        titles.insert(items.at(i).title);
+    }
+  }
+
+  for (size_t i = 0; i < items.size(); i++)
+    items.at(i).index = i;
+}
+
+FeedItem* Feed::FindItem(const std::wstring& identity) {
+  foreach_(it, items)
+    if (it->GetIdentity() == identity)
+      return &(*it);
+
+  return nullptr;
+}
+
+void Feed::SetSources(const std::vector<FeedSource>& sources) {
+  time_t time_now = time(nullptr);
+  std::vector<FeedSource> new_sources;
+
+  foreach_c_(it, sources) {
+    auto previous_source = this->sources.begin();
+    for ( ; previous_source != this->sources.end(); ++previous_source)
+      if (previous_source->address == it->address)
+        break;
+
+    if (previous_source != this->sources.end()) {
+      // Keep the state of the source, and check it earlier if its interval
+      // has become shorter
+      new_sources.push_back(*previous_source);
+      auto& source = new_sources.back();
+      source.interval = it->interval;
+      if (source.next_check > time_now + source.GetInterval())
+        source.next_check = time_now + source.GetInterval();
+    } else {
+      new_sources.push_back(FeedSource(it->address, it->interval));
+      new_sources.back().Schedule(time_now);
+    }
+  }
+
+  this->sources.swap(new_sources);
+}
+
 bool Feed::Download(int index) {
   if (category != kFeedCategoryLink)
     return false;
@@ -129,9 +426,12 @@ bool Feed::Download(int index) {
       }
     }
   }
-  if (index < 0 || index > static_cast<int>(items.size()))
+  if (download_index != -1)
+    return false;  // Another download is in progress
+  if (index < 0 || index >= static_cast<int>(items.size()))
     return false;
   download_index = index;
+  download_item_ = items.at(index);
 
   ui::ChangeStatusText(L"Downloading \"" + items[index].title + L"\"...");
   ui::EnableDialogInput(ui::kDialogTorrents, false);
@@ -146,16 +446,60 @@ bool Feed::Download(int index) {
 }
 
 bool Feed::ExamineData() {
+  // Recognition results depend on the anime database, the titles that are
+  // indexed by the recognition engine (e.g. user synonyms, which are not a
+  // part of the database revision) and the current date
+  std::wstring date = GetDate();
+  UINT64 title_signature = Meow.GetTitleSignature();
+  if (cached_revision_ != AnimeDatabase.revision() ||
+      cached_title_signature_ != title_signature ||
+      cached_date_ != date) {
+    cached_items_.clear();
+    cached_revision_ = AnimeDatabase.revision();
+    cached_title_signature_ = title_signature;
+    cached_date_ = date;
+  }
+
+  // Examine titles of new items
+  std::vector<anime::Episode> episodes;
+  std::vector<FeedItem*> new_items;
+  std::unordered_map<std::wstring, CachedItem> cached_items;
   foreach_(it, items) {
-    // Examine title and compare with anime list items
-    Meow.Parse(it->title, it->episode_data);
+    auto identity = it->GetIdentity();
+    auto cached_item = cached_items_.find(identity);
+    if (cached_item != cached_items_.end() &&
+        cached_item->second.title == it->title) {
+      static_cast<anime::Episode&>(it->episode_data) = cached_item->second.episode;
+      cached_items[identity] = cached_item->second;
+    } else {
+      Meow.Parse(it->title, it->episode_data);
+      episodes.push_back(it->episode_data);
+      new_items.push_back(&(*it));
+    }
+  }
+
+  // Compare with anime list items
+  if (!episodes.empty()) {
     static track::recognition::MatchOptions match_options;
     match_options.check_airing_date = true;
     match_options.check_anime_type = true;
     match_options.validate_episode_number = true;
-    Meow.Identify(it->episode_data, false, match_options);
+    Meow.IdentifyBatch(episodes, match_options);
+
+    auto episode = episodes.begin();
+    foreach_(it, new_items) {
+      static_cast<anime::Episode&>((*it)->episode_data) = *episode++;
+      auto& cached_item = cached_items[(*it)->GetIdentity()];
+      cached_item.title = (*it)->title;
+      cached_item.episode = (*it)->episode_data;
+    }
+  }
 
-    // Update last aired episode number
+  // Items that are no longer in the feed are dropped
+  cached_items_.swap(cached_items);
+
+  // Update last aired episode number
+  foreach_(it, items) {
     if (anime::IsValidId(it->episode_data.anime_id)) {
       auto anime_item = AnimeDatabase.FindItem(it->episode_data.anime_id);
       int episode_number = anime::GetEpisodeHigh(it->episode_data.number);
@@ -164,10 +508,25 @@ bool Feed::ExamineData() {
   }
 
   Aggregator.filter_manager.MarkNewEpisodes(*this);
-  // Preferences have lower priority, so we need to handle other filters
-  // first in order to avoid discarding items that we actually want.
-  Aggregator.filter_manager.Filter(*this, false);
-  Aggregator.filter_manager.Filter(*this, true);
+
+  // Filters are applied again only if their input has changed
+  UINT64 filter_signature = 0;
+  bool reusable = GetFilterSignature(filter_signature);
+  if (reusable && filter_signature == filter_signature_ &&
+      filter_states_.size() == items.size()) {
+    for (size_t i = 0; i < items.size(); i++)
+      items.at(i).state = filter_states_.at(i);
+  } else {
+    // Preferences have lower priority, so we need to handle other filters
+    // first in order to avoid discarding items that we actually want.
+    Aggregator.filter_manager.Filter(*this, false);
+    Aggregator.filter_manager.Filter(*this, true);
+    filter_signature_ = filter_signature;
+    filter_states_.clear();
+    if (reusable)
+      for (size_t i = 0; i < items.size(); i++)
+        filter_states_.push_back(items.at(i).state);
+  }
   // Archived items must be discarded after other filters are processed.
   Aggregator.filter_manager.FilterArchived(*this);
 
@@ -180,70 +539,196 @@ bool Feed::ExamineData() {
   return Aggregator.filter_manager.IsItemDownloadAvailable(*this);
 }
 
+// FNV-1a, over the values that filters can depend on
+static void HashValue(UINT64& hash, UINT64 value) {
+  for (int i = 0; i < 8; i++) {
+    hash ^= (value >> (i * 8)) & 0xFF;
+    hash *= 1099511628211ULL;
+  }
+}
+
+// Length is included, so that adjacent strings can't be mistaken for others
+static void HashValue(UINT64& hash, const std::wstring& str) {
+  HashValue(hash, static_cast<UINT64>(str.size()));
+  foreach_c_(c, str) {
+    hash ^= static_cast<UINT64>(*c);
+    hash *= 1099511628211ULL;
+  }
+}
+
+// Returns a hash of everything that filters can depend on, or false if filters
+// must be applied regardless (i.e. in debug mode).
+bool Feed::GetFilterSignature(UINT64& signature) const {
+  // Filter descriptions are modified in debug mode
+  if (Taiga.debug_mode)
+    return false;
+
+  // Values that contain variables depend on much more than the item (e.g. the
+  // last watched episode), so they're hashed as they're resolved for each item
+  std::vector<const std::wstring*> variable_values;
+  foreach_c_(filter, Aggregator.filter_manager.filters)
+    foreach_c_(condition, filter->conditions)
+      if (condition->value.find(L'%') != std::wstring::npos)
+        variable_values.push_back(&condition->value);
+
+  signature = 14695981039346656037ULL;
+
+  foreach_c_(filter, Aggregator.filter_manager.filters) {
+    HashValue(signature, filter->name);
+    HashValue(signature, filter->enabled);
+    HashValue(signature, filter->action);
+    HashValue(signature, filter->match);
+    HashValue(signature, filter->option);
+    HashValue(signature, filter->anime_ids.size());
+    foreach_c_(anime_id, filter->anime_ids)
+      HashValue(signature, *anime_id);
+    HashValue(signature, filter->conditions.size());
+    foreach_c_(condition, filter->conditions) {
+      HashValue(signature, condition->element);
+      HashValue(signature, condition->op);
+      HashValue(signature, condition->value);
+    }
+  }
+  HashValue(signature, Settings.GetBool(taiga::kTorrent_Filter_Enabled));
+  HashValue(signature, cached_revision_);
+  HashValue(signature, cached_title_signature_);
+  HashValue(signature, cached_date_);
+
+  HashValue(signature, items.size());
+  foreach_c_(it, items) {
+    HashValue(signature, it->title);
+    HashValue(signature, it->link);
+    HashValue(signature, it->category);
+    HashValue(signature, it->description);
+    HashValue(signature, it->episode_data.normal_title);
+    HashValue(signature, it->episode_data.anime_id);
+
+    auto anime_item = AnimeDatabase.FindItem(it->episode_data.anime_id);
+    if (anime_item) {
+      int number = anime::GetEpisodeHigh(it->episode_data.number);
+      HashValue(signature, anime_item->GetAiringStatus());
+      HashValue(signature, anime_item->GetType());
+      HashValue(signature, anime_item->GetEpisodeCount());
+      HashValue(signature, std::wstring(anime_item->GetDateStart()));
+      HashValue(signature, std::wstring(anime_item->GetDateEnd()));
+      HashValue(signature, anime_item->GetMyStatus());
+      HashValue(signature, anime_item->GetMyLastWatchedEpisode());
+      HashValue(signature, anime_item->IsEpisodeAvailable(number));
+    } else {
+      HashValue(signature, 0);
+    }
+
+    foreach_c_(value, variable_values)
+      HashValue(signature, ReplaceVariables(**value, it->episode_data));
+  }
+
+  return true;
+}
+
 std::wstring Feed::GetDataPath() {
-  std::wstring path = taiga::GetPath(taiga::kPathFeed);
+  return GetFeedDataPath(link);
+}
 
-  if (!link.empty()) {
-    Url url(link);
-    path += Base64Encode(url.host, true) + L"\\";
+int Feed::GetTimeToNextCheck() const {
+  time_t time_now = time(nullptr);
+  int result = 0;
+
+  foreach_c_(it, sources) {
+    if (it->address.empty() || it->GetInterval() <= 0)
+      continue;
+    int seconds = it->next_check > time_now ?
+                  static_cast<int>(it->next_check - time_now) : 1;
+    if (result == 0 || seconds < result)
+      result = seconds;
   }
 
-  return path;
+  return result;
 }
 
 bool Feed::Load() {
-  std::wstring file = GetDataPath() + L"feed.xml";
+  bool result = false;
+
+  foreach_(source, sources) {
+    std::wstring file = GetFeedDataPath(source->address) + L"feed.xml";
+    std::string data;
+    GenericFeed feed;
+    if (FileExists(file) && ReadFromFile(file, data) && Load(data, feed)) {
+      SwapFeedData(*source, feed);
+      source->loaded = true;
+      result = true;
+    }
+  }
+
+  search_source_ = FeedSource();
+  MergeSources();
+
+  return result;
+}
+
+bool Feed::Load(const std::string& data, GenericFeed& feed) const {
+  auto& items = feed.items;
   items.clear();
 
-  xml_document document;
-  xml_parse_result parse_result = document.load_file(file.c_str());
+  // A document tree is built only if the data can't be read directly
+  if (!ReadFeedData(data, feed)) {
+    xml_document document;
+    xml_parse_result parse_result = document.load_buffer(data.data(), data.size());
 
-  if (parse_result.status != pugi::status_ok)
-    return false;
+    if (parse_result.status != pugi::status_ok)
+      return false;
+
+    // Read channel information
+    xml_node channel = document.child(L"rss").child(L"channel");
+    feed.title = XmlReadStrValue(channel, L"title");
+    feed.link = XmlReadStrValue(channel, L"link");
+    feed.description = XmlReadStrValue(channel, L"description");
+
+    // Read items
+    foreach_xmlnode_(item, channel, L"item") {
+      items.resize(items.size() + 1);
+      items.back().category = XmlReadStrValue(item, L"category");
+      items.back().title = XmlReadStrValue(item, L"title");
+      items.back().link = XmlReadStrValue(item, L"link");
+      items.back().description = XmlReadStrValue(item, L"description");
+      items.back().guid = XmlReadStrValue(item, L"guid");
+      items.back().permalink =
+          !IsEqual(item.child(L"guid").attribute(L"isPermaLink").value(), L"false");
+    }
+  }
 
-  // Read channel information
-  xml_node channel = document.child(L"rss").child(L"channel");
-  title = XmlReadStrValue(channel, L"title");
-  link = XmlReadStrValue(channel, L"link");
-  description = XmlReadStrValue(channel, L"description");
-
-  // Read items
-  foreach_xmlnode_(item, channel, L"item") {
-    // Read data
-    items.resize(items.size() + 1);
-    items.back().index = items.size() - 1;
-    items.back().category = XmlReadStrValue(item, L"category");
-    items.back().title = XmlReadStrValue(item, L"title");
-    items.back().link = XmlReadStrValue(item, L"link");
-    items.back().description = XmlReadStrValue(item, L"description");
+  size_t count = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    auto& item = items.at(i);
 
     // Remove if title or link is empty
-    if (category == kFeedCategoryLink) {
-      if (items.back().title.empty() || items.back().link.empty()) {
-        items.pop_back();
+    if (category == kFeedCategoryLink)
+      if (item.title.empty() || item.link.empty())
         continue;
-      }
-    }
 
     // Clean up title
-    DecodeHtmlEntities(items.back().title);
-    ReplaceString(items.back().title, L"\\'", L"'");
+    DecodeHtmlEntities(item.title);
+    ReplaceString(item.title, L"\\'", L"'");
     // Clean up description
-    ReplaceString(items.back().description, L"<br/>", L"\n");
-    ReplaceString(items.back().description, L"<br />", L"\n");
-    StripHtmlTags(items.back().description);
-    DecodeHtmlEntities(items.back().description);
-    Trim(items.back().description, L" \n");
-    Aggregator.ParseDescription(items.back(), link);
-    ReplaceString(items.back().description, L"\n", L" | ");
+    ConvertHtmlTags(item.description);
+    DecodeHtmlEntities(item.description);
+    Trim(item.description, L" \n");
+    Aggregator.ParseDescription(item, feed.link);
+    ReplaceString(item.description, L"\n", L" | ");
+
+    if (count != i)
+      std::swap(items.at(count), item);
+    items.at(count).index = count;
+    count++;
   }
+  items.resize(count);
 
   return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
-Aggregator::Aggregator() {
+Aggregator::Aggregator()
+    : archive_journal_count_(0) {
   // Add torrent feed
   feeds.resize(feeds.size() + 1);
   feeds.back().category = kFeedCategoryLink;
@@ -262,40 +747,99 @@ bool Aggregator::Notify(const Feed& feed) {
 }
 
 bool Aggregator::SearchArchive(const std::wstring& file) {
-  foreach_(it, file_archive)
-    if (*it == file)
-      return true;
-
-  return false;
+  return file_archive.Contains(file);
 }
 
-void Aggregator::HandleFeedCheck(Feed& feed, const std::string& data,
-                                 bool automatic) {
-  std::wstring file = feed.GetDataPath() + L"feed.xml";
+void Aggregator::HandleFeedCheck(Feed& feed, const HttpResponse& response,
+                                 const std::string& data, bool automatic) {
+  auto source = feed.FindSource(response.uid);
+  if (!source)
+    return;  // Source was removed or checked again in the meantime
+  source->request_uid.clear();
 
-  SaveToFile(data, file);
+  if (response.code == 304) {
+    // Nothing has changed since the last check
+    source->failure_count = 0;
 
-  feed.Load();
+  } else {
+    // Raw data is kept only for debugging purposes
+    if (Taiga.debug_mode) {
+      std::wstring file = GetFeedDataPath(source->address) + L"feed.xml";
+      FeedDataWriter.Write(data, file);
+    }
+
+    GenericFeed result;
+    if (response.code < 400 && feed.Load(data, result)) {
+      SwapFeedData(*source, result);
+      source->loaded = true;
+      source->failure_count = 0;
+      source->etag.clear();
+      source->last_modified.clear();
+      foreach_c_(it, response.header) {
+        if (IsEqual(it->first, L"ETag")) {
+          source->etag = it->second;
+        } else if (IsEqual(it->first, L"Last-Modified")) {
+          source->last_modified = it->second;
+        }
+      }
+    } else {
+      // Items of the previous check are kept
+      LOG(LevelWarning, L"Could not read feed: " + source->address + L"\n"
+                        L"Response code: " + ToWstr(response.code));
+      source->failure_count++;
+    }
+  }
+
+  source->Schedule(time(nullptr));
+
+  feed.MergeSources();
 
   bool success = feed.ExamineData();
   ui::OnFeedCheck(success);
 
   if (automatic) {
-    switch (Settings.GetInt(taiga::kTorrent_Discovery_NewAction)) {
-      case 1:  // Notify
-        Notify(feed);
-        break;
-      case 2:  // Download
-        feed.Download(-1);
-        break;
+    // Other sources may have been checked before in this round, in which case
+    // only the newly selected items are worth acting upon
+    bool found_new_items = false;
+    foreach_(it, feed.items)
+      if (it->state == kFeedItemSelected)
+        if (feed.notified_items_.insert(it->GetIdentity()).second)
+          found_new_items = true;
+
+    if (found_new_items) {
+      switch (Settings.GetInt(taiga::kTorrent_Discovery_NewAction)) {
+        case 1:  // Notify
+          Notify(feed);
+          break;
+        case 2:  // Download
+          feed.Download(-1);
+          break;
+      }
     }
   }
 }
 
+void Aggregator::HandleFeedCheckError(Feed& feed,
+                                      const HttpResponse& response) {
+  auto source = feed.FindSource(response.uid);
+  if (!source)
+    return;
+
+  source->request_uid.clear();
+  source->failure_count++;
+  source->Schedule(time(nullptr));
+}
+
 void Aggregator::HandleFeedDownload(Feed& feed, const std::string& data,
                                     bool download_all) {
-  auto& feed_item = feed.items.at(feed.download_index);
+  if (feed.download_index == -1)
+    return;
 
+  // The item may have been moved or removed by a check in the meantime
+  auto feed_item = feed.download_item_;
+  auto current_item = feed.FindItem(feed_item.GetIdentity());
+  if (current_item)
+    current_item->state = kFeedItemDiscardedNormal;
   feed_item.state = kFeedItemDiscardedNormal;
   feed.download_index = -1;
 
@@ -308,7 +852,7 @@ void Aggregator::HandleFeedDownload(Feed& feed, const std::string& data,
     ui::OnFeedDownload(false, L"Torrent file doesn't exist");
     return;
   } else {
-    file_archive.push_back(feed_item.title);
+    AddToArchive(feed_item.title);
     ui::OnFeedDownload(true, L"");
   }
 
@@ -318,6 +862,10 @@ void Aggregator::HandleFeedDownload(Feed& feed, const std::string& data,
     feed.Download(-1);
 }
 
+void Aggregator::HandleFeedDownloadError(Feed& feed) {
+  feed.download_index = -1;
+}
+
 void Aggregator::HandleFeedDownloadOpen(FeedItem& feed_item,
                                         const std::wstring& file) {
   if (!Settings.GetBool(taiga::kTorrent_Download_AppOpen))
@@ -482,22 +1030,100 @@ void Aggregator::ParseDescription(FeedItem& feed_item,
   }
 }
 
+// Titles that are added to the archive are appended to a journal, one record
+// per line, so that we don't have to rewrite the whole archive each time. The
+// journal is merged into the archive file on save.
+static std::string EncodeArchiveRecord(const std::wstring& title) {
+  std::string record;
+  std::string str = WstrToStr(title);
+  record.reserve(str.size() + 1);
+
+  foreach_c_(c, str) {
+    switch (*c) {
+      case '\\': record.append("\\\\"); break;
+      case '\n': record.append("\\n"); break;
+      case '\r': record.append("\\r"); break;
+      default: record.push_back(*c); break;
+    }
+  }
+  record.push_back('\n');
+
+  return record;
+}
+
+static std::wstring DecodeArchiveRecord(const std::string& record) {
+  std::string str;
+  str.reserve(record.size());
+
+  for (size_t i = 0; i < record.size(); i++) {
+    if (record[i] == '\\' && i + 1 < record.size()) {
+      switch (record[++i]) {
+        case 'n': str.push_back('\n'); break;
+        case 'r': str.push_back('\r'); break;
+        default: str.push_back(record[i]); break;
+      }
+    } else {
+      str.push_back(record[i]);
+    }
+  }
+
+  return StrToWstr(str);
+}
+
+void Aggregator::AddToArchive(const std::wstring& file) {
+  size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
+  file_archive.set_max_count(max_count);
+  file_archive.Add(file);
+
+  if (max_count == 0)
+    return;  // Nothing is kept on disk
+
+  std::wstring path = taiga::GetPath(taiga::kPathFeedHistoryJournal);
+  if (!AppendToFile(EncodeArchiveRecord(file), path)) {
+    SaveArchive();
+    return;
+  }
+
+  // Merge the journal once it gets larger than the archive itself
+  if (++archive_journal_count_ > max_count)
+    SaveArchive();
+}
+
 bool Aggregator::LoadArchive() {
   xml_document document;
   std::wstring path = taiga::GetPath(taiga::kPathFeedHistory);
   xml_parse_result parse_result = document.load_file(path.c_str());
 
-  if (parse_result.status != pugi::status_ok)
-    return false;
+  size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
+  file_archive.Clear();
+  file_archive.set_max_count(max_count);
 
   // Read discarded
-  file_archive.clear();
-  xml_node archive_node = document.child(L"archive");
-  foreach_xmlnode_(node, archive_node, L"item") {
-    file_archive.push_back(node.attribute(L"title").value());
+  if (parse_result.status == pugi::status_ok) {
+    xml_node archive_node = document.child(L"archive");
+    foreach_xmlnode_(node, archive_node, L"item") {
+      file_archive.Add(node.attribute(L"title").value());
+    }
   }
 
-  return true;
+  // Replay the journal
+  archive_journal_count_ = 0;
+  std::string journal;
+  path = taiga::GetPath(taiga::kPathFeedHistoryJournal);
+  if (FileExists(path) && ReadFromFile(path, journal)) {
+    for (size_t pos = 0; pos < journal.size(); ) {
+      size_t pos_end = journal.find('\n', pos);
+      if (pos_end == std::string::npos)
+        break;  // Incomplete record
+      if (pos_end > pos) {
+        file_archive.Add(DecodeArchiveRecord(journal.substr(pos, pos_end - pos)));
+        archive_journal_count_++;
+      }
+      pos = pos_end + 1;
+    }
+  }
+
+  return parse_result.status == pugi::status_ok || archive_journal_count_ > 0;
 }
 
 bool Aggregator::SaveArchive() {
@@ -505,20 +1131,27 @@ bool Aggregator::SaveArchive() {
   xml_node archive_node = document.append_child(L"archive");
 
   size_t max_count = Settings.GetInt(taiga::kTorrent_Filter_ArchiveMaxCount);
+  file_archive.set_max_count(max_count);
 
   if (max_count > 0) {
-    size_t length = file_archive.size();
-    size_t i = 0;
-    if (length > max_count)
-      i = length - max_count;
-    for ( ; i < file_archive.size(); i++) {
+    foreach_c_(it, file_archive.titles()) {
       xml_node xml_item = archive_node.append_child(L"item");
-      xml_item.append_attribute(L"title") = file_archive[i].c_str();
+      xml_item.append_attribute(L"title") = it->c_str();
     }
   }
 
   std::wstring path = taiga::GetPath(taiga::kPathFeedHistory);
-  return XmlWriteDocumentToFile(document, path);
+  bool result = XmlWriteDocumentToFile(document, path);
+
+  // The journal is now part of the archive
+  if (result) {
+    path = taiga::GetPath(taiga::kPathFeedHistoryJournal);
+    if (FileExists(path))
+      ::DeleteFile(path.c_str());
+    archive_journal_count_ = 0;
+  }
+
+  return result;
 }
 
 bool Aggregator::CompareFeedItems(const GenericFeedItem& item1,
@@ -19,11 +19,15 @@
 #ifndef TAIGA_TRACK_FEED_H
 #define TAIGA_TRACK_FEED_H
 
+#include <ctime>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "base/types.h"
 #include "library/anime_episode.h"
+#include "track/feed_archive.h"
 #include "track/feed_filter.h"
 
 enum FeedItemState {
@@ -68,6 +72,8 @@ public:
                source;
 
   bool permalink;
+
+  std::wstring GetIdentity() const;
 };
 
 class FeedItem : public GenericFeedItem {
@@ -108,19 +114,89 @@ public:
   std::vector<FeedItem> items;
 };
 
+// A feed that is checked periodically, along with the items that were read in
+// the last successful check
+class FeedSource : public GenericFeed {
+public:
+  FeedSource();
+  FeedSource(const std::wstring& address, int interval = 0);
+  ~FeedSource() {}
+
+  int GetInterval() const;
+  bool IsDue(time_t current_time) const;
+  void Schedule(time_t current_time);
+
+  std::wstring address;
+  int interval;  // in minutes, 0 to use the global setting
+
+  // Validators of the last response, so that the server can tell us that
+  // nothing has changed since then
+  std::wstring etag;
+  std::wstring last_modified;
+
+  bool loaded;
+  unsigned int failure_count;
+  time_t next_check;
+  std::wstring request_uid;  // Not empty while a check is in progress
+};
+
 class Feed : public GenericFeed {
 public:
   Feed();
   ~Feed() {}
 
   bool Check(const std::wstring& source, bool automatic = false);
+  bool CheckSources(bool automatic = false);
   bool Download(int index);
   bool ExamineData();
   std::wstring GetDataPath();
+  int GetTimeToNextCheck() const;
   bool Load();
+  bool Load(const std::string& data, GenericFeed& feed) const;
+  void SetSources(const std::vector<FeedSource>& sources);
 
   FeedCategory category;
-  int download_index;
+  int download_index;  // Not -1 while a download is in progress
+
+  // Items of all sources are merged into a single list, in the same order as
+  // the sources. The first one is the main source.
+  std::vector<FeedSource> sources;
+
+private:
+  friend class Aggregator;
+
+  bool CheckSource(FeedSource& source, bool automatic);
+  FeedSource* FindSource(const std::wstring& request_uid);
+  FeedItem* FindItem(const std::wstring& identity);
+  void MergeSources();
+
+  bool GetFilterSignature(UINT64& signature) const;
+
+  // Holds the results of a check that's not made for a source (e.g. search)
+  FeedSource search_source_;
+
+  // Items are rebuilt and reordered by each check, so the item that is being
+  // downloaded is looked up again by its identity when the download finishes
+  FeedItem download_item_;
+
+  // Selected items that were already acted upon in the current automatic check
+  std::unordered_set<std::wstring> notified_items_;
+
+  // Recognition results of the items that were seen in previous checks,
+  // keyed by item identity (see Aggregator::CompareFeedItems)
+  class CachedItem {
+  public:
+    std::wstring title;
+    anime::Episode episode;
+  };
+  std::unordered_map<std::wstring, CachedItem> cached_items_;
+  std::wstring cached_date_;
+  unsigned int cached_revision_;
+  UINT64 cached_title_signature_;
+
+  // Item states after the last time filters were applied
+  UINT64 filter_signature_;
+  std::vector<FeedItemState> filter_states_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -132,22 +208,26 @@ public:
 
   Feed* Get(FeedCategory category);
 
-  void HandleFeedCheck(Feed& feed, const std::string& data, bool automatic);
+  void HandleFeedCheck(Feed& feed, const HttpResponse& response, const std::string& data, bool automatic);
+  void HandleFeedCheckError(Feed& feed, const HttpResponse& response);
   void HandleFeedDownload(Feed& feed, const std::string& data, bool download_all);
+  void HandleFeedDownloadError(Feed& feed);
   bool ValidateFeedDownload(const HttpRequest& http_request, HttpResponse& http_response);
 
   bool Notify(const Feed& feed);
   void ParseDescription(FeedItem& feed_item, const std::wstring& source);
 
+  void AddToArchive(const std::wstring& file);
   bool LoadArchive();
   bool SaveArchive();
   bool SearchArchive(const std::wstring& file);
 
   std::vector<Feed> feeds;
-  std::vector<std::wstring> file_archive;
+  FeedArchive file_archive;
   FeedFilterManager filter_manager;
 
 private:
+  size_t archive_journal_count_;
   bool CompareFeedItems(const GenericFeedItem& item1, const GenericFeedItem& item2);
   void HandleFeedDownloadOpen(FeedItem& feed_item, const std::wstring& file);
 };
@@ -0,0 +1,77 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <iterator>
+
+#include "track/feed_archive.h"
+
+FeedArchive::FeedArchive()
+    : max_count_(0) {
+}
+
+bool FeedArchive::Add(const std::wstring& title) {
+  auto it = index_.find(title);
+
+  if (it != index_.end()) {
+    titles_.splice(titles_.end(), titles_, it->second);
+    return false;
+  }
+
+  titles_.push_back(title);
+  index_.insert(std::make_pair(title, std::prev(titles_.end())));
+  Trim();
+
+  return true;
+}
+
+void FeedArchive::Clear() {
+  index_.clear();
+  titles_.clear();
+}
+
+bool FeedArchive::Contains(const std::wstring& title) const {
+  return index_.find(title) != index_.end();
+}
+
+void FeedArchive::Trim() {
+  if (max_count_ == 0)
+    return;
+
+  while (titles_.size() > max_count_) {
+    index_.erase(titles_.front());
+    titles_.pop_front();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const FeedArchive::title_list_t& FeedArchive::titles() const {
+  return titles_;
+}
+
+size_t FeedArchive::max_count() const {
+  return max_count_;
+}
+
+size_t FeedArchive::size() const {
+  return titles_.size();
+}
+
+void FeedArchive::set_max_count(size_t max_count) {
+  max_count_ = max_count;
+  Trim();
+}
@@ -0,0 +1,52 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TAIGA_TRACK_FEED_ARCHIVE_H
+#define TAIGA_TRACK_FEED_ARCHIVE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Titles of the feed items that were downloaded or discarded before, in the
+// order they were added. When the archive is full, adding a new title evicts
+// the oldest one, while adding an existing title makes it the newest again.
+class FeedArchive {
+public:
+  typedef std::list<std::wstring> title_list_t;
+
+  FeedArchive();
+  ~FeedArchive() {}
+
+  bool Add(const std::wstring& title);
+  void Clear();
+  bool Contains(const std::wstring& title) const;
+
+  const title_list_t& titles() const;
+  size_t max_count() const;
+  size_t size() const;
+  void set_max_count(size_t max_count);
+
+private:
+  void Trim();
+
+  title_list_t titles_;
+  std::unordered_map<std::wstring, title_list_t::iterator> index_;
+  size_t max_count_;  // No limit if zero
+};
+
+#endif  // TAIGA_TRACK_FEED_ARCHIVE_H
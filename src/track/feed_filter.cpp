@@ -16,6 +16,8 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
@@ -29,166 +31,228 @@
 #include "track/feed.h"
 #include "track/feed_filter.h"
 
-bool EvaluateCondition(const FeedFilterCondition& condition,
-                       const FeedItem& item) {
-  bool is_numeric = false;
-  std::wstring element;
-  std::wstring value = ReplaceVariables(condition.value, item.episode_data);
-  auto anime = AnimeDatabase.FindItem(item.episode_data.anime_id);
+namespace {
 
-  switch (condition.element) {
-    case kFeedFilterElement_File_Title:
-      element = item.title;
-      break;
-    case kFeedFilterElement_File_Category:
-      element = item.category;
-      break;
-    case kFeedFilterElement_File_Description:
-      element = item.description;
-      break;
-    case kFeedFilterElement_File_Link:
-      element = item.link;
-      break;
+// Item data that is shared by all conditions of a filter
+class FeedFilterContext {
+public:
+  FeedFilterContext(const FeedItem& item, bool requires_anime)
+      : anime(requires_anime ?
+              AnimeDatabase.FindItem(item.episode_data.anime_id) : nullptr),
+        episode_number(anime::GetEpisodeHigh(item.episode_data.number)) {
+  }
+
+  const anime::Item* anime;
+  int episode_number;
+};
+
+bool IsAnimeElement(FeedFilterElement element) {
+  switch (element) {
     case kFeedFilterElement_Meta_Id:
-      if (anime)
-        element = ToWstr(anime->GetId());
-      is_numeric = true;
-      break;
-    case kFeedFilterElement_Episode_Title:
-      element = item.episode_data.title;
-      break;
+    case kFeedFilterElement_Meta_Status:
+    case kFeedFilterElement_Meta_Type:
+    case kFeedFilterElement_Meta_Episodes:
     case kFeedFilterElement_Meta_DateStart:
-      if (anime)
-        element = anime->GetDateStart();
-      break;
     case kFeedFilterElement_Meta_DateEnd:
-      if (anime)
-        element = anime->GetDateEnd();
-      break;
+    case kFeedFilterElement_User_Status:
+    case kFeedFilterElement_Local_EpisodeAvailable:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsNumericElement(FeedFilterElement element) {
+  switch (element) {
+    case kFeedFilterElement_Meta_Id:
+    case kFeedFilterElement_Meta_Status:
+    case kFeedFilterElement_Meta_Type:
     case kFeedFilterElement_Meta_Episodes:
-      if (anime)
-        element = ToWstr(anime->GetEpisodeCount());
-      is_numeric = true;
-      break;
+    case kFeedFilterElement_User_Status:
+    case kFeedFilterElement_Local_EpisodeAvailable:
+    case kFeedFilterElement_Episode_Number:
+    case kFeedFilterElement_Episode_Version:
+      return true;
+    default:
+      return false;
+  }
+}
+
+int GetNumericElement(const FeedFilterCompiledCondition& condition,
+                      const FeedItem& item,
+                      const FeedFilterContext& context) {
+  auto anime = context.anime;
+
+  switch (condition.element) {
+    case kFeedFilterElement_Meta_Id:
+      return anime ? anime->GetId() : 0;
+    case kFeedFilterElement_Meta_Episodes:
+      return anime ? anime->GetEpisodeCount() : 0;
     case kFeedFilterElement_Meta_Status:
-      if (anime)
-        element = ToWstr(anime->GetAiringStatus());
-      is_numeric = true;
-      break;
+      return anime ? anime->GetAiringStatus() : 0;
     case kFeedFilterElement_Meta_Type:
-      if (anime)
-        element = ToWstr(anime->GetType());
-      is_numeric = true;
-      break;
+      return anime ? anime->GetType() : 0;
     case kFeedFilterElement_User_Status:
-      element = ToWstr(anime ? anime->GetMyStatus() : anime::kNotInList);
-      is_numeric = true;
-      break;
+      return anime ? anime->GetMyStatus() : anime::kNotInList;
     case kFeedFilterElement_Episode_Number:
-      element = ToWstr(anime::GetEpisodeHigh(item.episode_data.number));
-      is_numeric = true;
-      break;
+      return context.episode_number;
     case kFeedFilterElement_Episode_Version:
-      element = item.episode_data.version;
-      if (element.empty())
-        element = L"1";
-      is_numeric = true;
-      break;
+      if (item.episode_data.version.empty())
+        return 1;
+      return ToInt(item.episode_data.version);
     case kFeedFilterElement_Local_EpisodeAvailable:
       if (anime)
-        element = ToWstr(anime->IsEpisodeAvailable(
-            anime::GetEpisodeHigh(item.episode_data.number)));
-      is_numeric = true;
-      break;
+        return anime->IsEpisodeAvailable(context.episode_number) ? 1 : 0;
+      return 0;
+  }
+
+  return 0;
+}
+
+const std::wstring& GetElement(const FeedFilterCompiledCondition& condition,
+                                     const FeedItem& item,
+                                     const FeedFilterContext& context,
+                                     std::wstring& buffer) {
+  switch (condition.element) {
+    case kFeedFilterElement_File_Title:
+      return item.title;
+    case kFeedFilterElement_File_Category:
+      return item.category;
+    case kFeedFilterElement_File_Description:
+      return item.description;
+    case kFeedFilterElement_File_Link:
+      return item.link;
+    case kFeedFilterElement_Episode_Title:
+      return item.episode_data.title;
+    case kFeedFilterElement_Meta_DateStart:
+      if (context.anime)
+        buffer = context.anime->GetDateStart();
+      return buffer;
+    case kFeedFilterElement_Meta_DateEnd:
+      if (context.anime)
+        buffer = context.anime->GetDateEnd();
+      return buffer;
     case kFeedFilterElement_Episode_Group:
-      element = item.episode_data.group;
-      break;
+      return item.episode_data.group;
     case kFeedFilterElement_Episode_VideoResolution:
-      element = item.episode_data.resolution;
-      break;
+      return item.episode_data.resolution;
     case kFeedFilterElement_Episode_VideoType:
-      element = item.episode_data.video_type;
-      break;
+      return item.episode_data.video_type;
+    case kFeedFilterElement_Episode_Version:
+      if (item.episode_data.version.empty())
+        buffer = L"1";
+      else
+        return item.episode_data.version;
+      return buffer;
+    case kFeedFilterElement_Episode_Number:
+    case kFeedFilterElement_User_Status:
+      buffer = ToWstr(GetNumericElement(condition, item, context));
+      return buffer;
+    case kFeedFilterElement_Meta_Id:
+    case kFeedFilterElement_Meta_Status:
+    case kFeedFilterElement_Meta_Type:
+    case kFeedFilterElement_Meta_Episodes:
+    case kFeedFilterElement_Local_EpisodeAvailable:
+      if (context.anime)  // Empty for unknown anime
+        buffer = ToWstr(GetNumericElement(condition, item, context));
+      return buffer;
+  }
+
+  return buffer;
+}
+
+bool EvaluateCondition(const FeedFilterCompiledCondition& condition,
+                       const FeedItem& item,
+                       const FeedFilterContext& context) {
+  // Values that don't reference any variables are substituted in advance
+  std::wstring substituted_value;
+  if (condition.has_variables)
+    substituted_value = ReplaceVariables(condition.raw_value, item.episode_data);
+  const std::wstring& value =
+      condition.has_variables ? substituted_value : condition.value;
+
+  if (condition.is_numeric) {
+    int element = GetNumericElement(condition, item, context);
+
+    bool is_true = condition.is_true;
+    int number = condition.number;
+    if (condition.has_variables) {
+      is_true = IsEqual(value, L"True");
+      number = ToInt(value);
+    }
+
+    switch (condition.op) {
+      case kFeedFilterOperator_Equals:
+      case kFeedFilterOperator_NotEquals:
+        if (is_true)
+          return element == TRUE;
+        if (condition.op == kFeedFilterOperator_Equals)
+          return element == number;
+        return element != number;
+      case kFeedFilterOperator_IsGreaterThan:
+        return element > number;
+      case kFeedFilterOperator_IsGreaterThanOrEqualTo:
+        return element >= number;
+      case kFeedFilterOperator_IsLessThan:
+        return element < number;
+      case kFeedFilterOperator_IsLessThanOrEqualTo:
+        return element <= number;
+    }
+  }
+
+  std::wstring buffer;
+  const std::wstring& element = GetElement(condition, item, context, buffer);
+
+  if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
+    int resolution = anime::TranslateResolution(element);
+    switch (condition.op) {
+      case kFeedFilterOperator_Equals:
+        return resolution == condition.resolution;
+      case kFeedFilterOperator_NotEquals:
+        return resolution != condition.resolution;
+      case kFeedFilterOperator_IsGreaterThan:
+        return resolution > condition.resolution;
+      case kFeedFilterOperator_IsGreaterThanOrEqualTo:
+        return resolution >= condition.resolution;
+      case kFeedFilterOperator_IsLessThan:
+        return resolution < condition.resolution;
+      case kFeedFilterOperator_IsLessThanOrEqualTo:
+        return resolution <= condition.resolution;
+    }
   }
 
   switch (condition.op) {
     case kFeedFilterOperator_Equals:
-      if (is_numeric) {
-        if (IsEqual(value, L"True"))
-          return ToInt(element) == TRUE;
-        return ToInt(element) == ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) == anime::TranslateResolution(condition.value);
-        } else {
-          return IsEqual(element, value);
-        }
-      }
+      return IsEqual(element, value);
     case kFeedFilterOperator_NotEquals:
-      if (is_numeric) {
-        if (IsEqual(value, L"True"))
-          return ToInt(element) == TRUE;
-        return ToInt(element) != ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) != anime::TranslateResolution(condition.value);
-        } else {
-          return !IsEqual(element, value);
-        }
-      }
+      return !IsEqual(element, value);
     case kFeedFilterOperator_IsGreaterThan:
-      if (is_numeric) {
-        return ToInt(element) > ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) > anime::TranslateResolution(condition.value);
-        } else {
-          return CompareStrings(element, condition.value) > 0;
-        }
-      }
+      return CompareStrings(element, condition.raw_value) > 0;
     case kFeedFilterOperator_IsGreaterThanOrEqualTo:
-      if (is_numeric) {
-        return ToInt(element) >= ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) >= anime::TranslateResolution(condition.value);
-        } else {
-          return CompareStrings(element, condition.value) >= 0;
-        }
-      }
+      return CompareStrings(element, condition.raw_value) >= 0;
     case kFeedFilterOperator_IsLessThan:
-      if (is_numeric) {
-        return ToInt(element) < ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) < anime::TranslateResolution(condition.value);
-        } else {
-          return CompareStrings(element, condition.value) < 0;
-        }
-      }
+      return CompareStrings(element, condition.raw_value) < 0;
     case kFeedFilterOperator_IsLessThanOrEqualTo:
-      if (is_numeric) {
-        return ToInt(element) <= ToInt(value);
-      } else {
-        if (condition.element == kFeedFilterElement_Episode_VideoResolution) {
-          return anime::TranslateResolution(element) <= anime::TranslateResolution(condition.value);
-        } else {
-          return CompareStrings(element, condition.value) <= 0;
-        }
-      }
+      return CompareStrings(element, condition.raw_value) <= 0;
     case kFeedFilterOperator_BeginsWith:
       return StartsWith(element, value);
     case kFeedFilterOperator_EndsWith:
       return EndsWith(element, value);
     case kFeedFilterOperator_Contains:
-      return InStr(element, value, 0, true) > -1;
+      if (condition.has_variables)
+        return InStr(element, value, 0, true) > -1;
+      return condition.searcher.Find(element) > -1;
     case kFeedFilterOperator_NotContains:
-      return InStr(element, value, 0, true) == -1;
+      if (condition.has_variables)
+        return InStr(element, value, 0, true) == -1;
+      return condition.searcher.Find(element) == -1;
   }
 
   return false;
 }
 
+}  // namespace
+
 ////////////////////////////////////////////////////////////////////////////////
 
 FeedFilterCondition::FeedFilterCondition()
@@ -212,11 +276,50 @@ void FeedFilterCondition::Reset() {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+FeedFilterCompiledCondition::FeedFilterCompiledCondition()
+    : element(kFeedFilterElement_None),
+      op(kFeedFilterOperator_Equals),
+      is_numeric(false),
+      has_variables(false),
+      is_true(false),
+      number(0),
+      resolution(0) {
+}
+
+void FeedFilterCompiledCondition::Compile(const FeedFilterCondition& condition) {
+  element = condition.element;
+  op = condition.op;
+  is_numeric = IsNumericElement(condition.element);
+  has_variables = condition.value.find(L'%') != std::wstring::npos;
+
+  raw_value = condition.value;
+  if (has_variables) {
+    value.clear();
+  } else {
+    // Functions and escape sequences don't depend on the item
+    value = ReplaceVariables(condition.value, anime::Episode());
+  }
+
+  is_true = IsEqual(value, L"True");
+  number = ToInt(value);
+  resolution = anime::TranslateResolution(condition.value);
+
+  switch (op) {
+    case kFeedFilterOperator_Contains:
+    case kFeedFilterOperator_NotContains:
+      searcher.Compile(value);
+      break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 FeedFilter::FeedFilter()
     : action(kFeedFilterActionDiscard),
       enabled(true),
       match(kFeedFilterMatchAll),
-      option(kFeedFilterOptionDefault) {
+      option(kFeedFilterOptionDefault),
+      requires_anime_(false) {
 }
 
 FeedFilter& FeedFilter::operator=(const FeedFilter& filter) {
@@ -246,6 +349,17 @@ void FeedFilter::AddCondition(FeedFilterElement element,
   conditions.back().value = value;
 }
 
+void FeedFilter::Compile() {
+  compiled_conditions_.resize(conditions.size());
+  requires_anime_ = false;
+
+  for (size_t i = 0; i < conditions.size(); i++) {
+    compiled_conditions_.at(i).Compile(conditions.at(i));
+    if (IsAnimeElement(conditions.at(i).element))
+      requires_anime_ = true;
+  }
+}
+
 bool FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
   if (!enabled)
     return false;
@@ -254,18 +368,10 @@ bool FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
   if (item.IsDiscarded())
     return false;
 
-  if (!anime_ids.empty()) {
-    bool apply_filter = false;
-    foreach_(id, anime_ids) {
-      if (*id == item.episode_data.anime_id) {
-        apply_filter = true;
-        break;
-      }
-    }
-    if (!apply_filter)
-      return false;  // Filter doesn't apply to this item
-  }
+  if (compiled_conditions_.size() != conditions.size())
+    Compile();
 
+  FeedFilterContext context(item, requires_anime_);
   bool matched = false;
   size_t condition_index = 0;  // Used only for debugging purposes
 
@@ -273,7 +379,7 @@ bool FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
     case kFeedFilterMatchAll:
       matched = true;
       for (size_t i = 0; i < conditions.size(); i++) {
-        if (!EvaluateCondition(conditions.at(i), item)) {
+        if (!EvaluateCondition(compiled_conditions_.at(i), item, context)) {
           matched = false;
           condition_index = i;
           break;
@@ -283,7 +389,7 @@ bool FeedFilter::Filter(Feed& feed, FeedItem& item, bool recursive) {
     case kFeedFilterMatchAny:
       matched = false;
       for (size_t i = 0; i < conditions.size(); i++) {
-        if (EvaluateCondition(conditions.at(i), item)) {
+        if (EvaluateCondition(compiled_conditions_.at(i), item, context)) {
           matched = true;
           condition_index = i;
           break;
@@ -474,19 +580,73 @@ void FeedFilterManager::Cleanup() {
   }
 }
 
+void FeedFilterManager::Compile() {
+  filter_index_.Clear();
+  preference_index_.Clear();
+
+  for (size_t i = 0; i < filters.size(); i++) {
+    auto& filter = filters.at(i);
+    filter.Compile();
+    if (!filter.enabled)
+      continue;
+    auto& index = filter.action == kFeedFilterActionPrefer ?
+                  preference_index_ : filter_index_;
+    index.Add(i, filter.anime_ids);
+  }
+}
+
 void FeedFilterManager::Filter(Feed& feed, bool preferences) {
   if (!Settings.GetBool(taiga::kTorrent_Filter_Enabled))
     return;
 
+  // Filters can be edited from several places, so we compile them once per
+  // pass rather than keeping track of each change
+  Compile();
+
+  const auto& index = preferences ? preference_index_ : filter_index_;
+  std::vector<size_t> buffer;
+
   foreach_(item, feed.items) {
-    foreach_(filter, filters) {
-      if (preferences != (filter->action == kFeedFilterActionPrefer))
-        continue;
-      filter->Filter(feed, *item, true);
-    }
+    const auto& filter_indexes = index.Find(item->episode_data.anime_id, buffer);
+    foreach_c_(it, filter_indexes)
+      filters.at(*it).Filter(feed, *item, true);
   }
 }
 
+void FeedFilterManager::FilterIndex::Add(size_t index,
+                                         const std::vector<int>& anime_ids) {
+  if (anime_ids.empty()) {
+    unlimited_.push_back(index);
+    return;
+  }
+
+  foreach_c_(id, anime_ids) {
+    auto& indexes = limited_[*id];
+    if (indexes.empty() || indexes.back() != index)
+      indexes.push_back(index);
+  }
+}
+
+void FeedFilterManager::FilterIndex::Clear() {
+  limited_.clear();
+  unlimited_.clear();
+}
+
+// Returns applicable filters in their original order
+const std::vector<size_t>& FeedFilterManager::FilterIndex::Find(
+    int anime_id, std::vector<size_t>& buffer) const {
+  auto it = limited_.find(anime_id);
+  if (it == limited_.end())
+    return unlimited_;
+  if (unlimited_.empty())
+    return it->second;
+
+  buffer.resize(it->second.size() + unlimited_.size());
+  std::merge(it->second.begin(), it->second.end(),
+             unlimited_.begin(), unlimited_.end(), buffer.begin());
+  return buffer;
+}
+
 void FeedFilterManager::FilterArchived(Feed& feed) {
   foreach_(item, feed.items) {
     if (!item->IsDiscarded()) {
@@ -21,8 +21,11 @@
 
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "base/string.h"
+
 namespace pugi {
 class xml_node;
 }
@@ -107,6 +110,28 @@ public:
   std::wstring value;
 };
 
+// A condition compiled for evaluation, with its value translated in advance
+// into the form that the element is compared against.
+class FeedFilterCompiledCondition {
+public:
+  FeedFilterCompiledCondition();
+  ~FeedFilterCompiledCondition() {}
+
+  void Compile(const FeedFilterCondition& condition);
+
+public:
+  FeedFilterElement element;
+  FeedFilterOperator op;
+  bool is_numeric;
+  bool has_variables;  // Value must be substituted for each item
+  bool is_true;
+  int number;
+  int resolution;
+  std::wstring raw_value;
+  std::wstring value;
+  CaseInsensitiveSearcher searcher;  // For contains/notcontains operators
+};
+
 class FeedFilter {
 public:
   FeedFilter();
@@ -115,10 +140,15 @@ public:
   FeedFilter& operator=(const FeedFilter& filter);
 
   void AddCondition(FeedFilterElement element, FeedFilterOperator op, const std::wstring& value);
+  void Compile();
+  // Precondition: if the filter is limited to certain anime, the item must
+  // belong to one of them. anime_ids is not checked here; items are
+  // pre-selected by FeedFilterManager::Filter through its FilterIndex.
   bool Filter(Feed& feed, FeedItem& item, bool recursive);
   void Reset();
 
 public:
+  // Only called for weak preferences, which are not limited to any anime
   bool ApplyPreferenceFilter(Feed& feed, FeedItem& item);
 
   std::wstring name;
@@ -130,6 +160,10 @@ public:
 
   std::vector<int> anime_ids;
   std::vector<FeedFilterCondition> conditions;
+
+private:
+  std::vector<FeedFilterCompiledCondition> compiled_conditions_;
+  bool requires_anime_;
 };
 
 class FeedFilterPreset {
@@ -153,6 +187,7 @@ public:
   void AddPresets();
   void AddFilter(FeedFilterAction action, FeedFilterMatch match, FeedFilterOption option, bool enabled, const std::wstring& name);
   void Cleanup();
+  void Compile();
   void Filter(Feed& feed, bool preferences);
   void FilterArchived(Feed& feed);
   bool IsItemDownloadAvailable(Feed& feed);
@@ -181,6 +216,21 @@ public:
   std::vector<FeedFilterPreset> presets;
 
 private:
+  // Indexes of enabled filters, grouped by the anime they're limited to, so
+  // that each item is checked only against the filters that can apply to it
+  class FilterIndex {
+  public:
+    void Add(size_t index, const std::vector<int>& anime_ids);
+    void Clear();
+    const std::vector<size_t>& Find(int anime_id, std::vector<size_t>& buffer) const;
+
+  private:
+    std::unordered_map<int, std::vector<size_t>> limited_;
+    std::vector<size_t> unlimited_;
+  };
+  FilterIndex filter_index_;
+  FilterIndex preference_index_;
+
   std::map<int, std::wstring> action_shortcodes_;
   std::map<int, std::wstring> element_shortcodes_;
   std::map<int, std::wstring> match_shortcodes_;
@@ -0,0 +1,577 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include "base/string.h"
+#include "track/feed.h"
+#include "track/feed_parser.h"
+
+namespace {
+
+bool IsValidUtf8(const std::string& str) {
+  for (size_t i = 0; i < str.size(); ) {
+    unsigned char c = static_cast<unsigned char>(str[i]);
+    size_t length = 0;
+    unsigned long code_point = 0;
+    if (c < 0x80) {
+      i++;
+      continue;
+    } else if ((c & 0xE0) == 0xC0) {
+      length = 2;
+      code_point = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+      length = 3;
+      code_point = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+      length = 4;
+      code_point = c & 0x07;
+    } else {
+      return false;
+    }
+    if (i + length > str.size())
+      return false;
+    for (size_t j = 1; j < length; j++) {
+      unsigned char next = static_cast<unsigned char>(str[i + j]);
+      if ((next & 0xC0) != 0x80)
+        return false;
+      code_point = (code_point << 6) | (next & 0x3F);
+    }
+    static const unsigned long kMinimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (code_point < kMinimum[length] || code_point > 0x10FFFF ||
+        (code_point >= 0xD800 && code_point <= 0xDFFF))
+      return false;
+    i += length;
+  }
+  return true;
+}
+
+// Collects the values that are read from a document. Each element is read
+// from its first text or CDATA child, the same way xml_node::child_value does.
+class FeedElement {
+public:
+  FeedElement() : found(false), has_value(false) {}
+
+  bool found;
+  bool has_value;
+  std::string value;
+};
+
+class FeedItemElements {
+public:
+  FeedItemElements() : permalink(true) {}
+
+  FeedElement title, link, description, category, guid;
+  bool permalink;
+};
+
+class FeedReader {
+public:
+  FeedReader(const std::string& data, GenericFeed& feed);
+
+  bool Read();
+
+private:
+  bool IsNameCharacter(char c, bool first) const;
+  bool IsWhitespace(char c) const;
+  bool StartsWith(const char* str) const;
+  bool SkipPast(const char* str);
+  bool ReadName(std::string& name);
+
+  bool ReadCData();
+  bool ReadDeclaration();
+  bool ReadEndTag();
+  bool ReadStartTag();
+  bool ReadText();
+
+  bool ReadAttributeValue(std::string& value);
+  bool DecodeText(const char* begin, const char* end, std::string& output) const;
+  FeedElement* FindElement(const std::string& name);
+  bool Flush();
+
+  const char* pos_;
+  const char* end_;
+
+  GenericFeed& feed_;
+  std::vector<std::string> elements_;
+  size_t channel_count_;
+
+  FeedElement channel_title_, channel_link_, channel_description_;
+  std::vector<FeedItemElements> items_;
+  FeedElement* current_element_;
+  size_t current_depth_;
+};
+
+FeedReader::FeedReader(const std::string& data, GenericFeed& feed)
+    : pos_(data.data()),
+      end_(data.data() + data.size()),
+      feed_(feed),
+      channel_count_(0),
+      current_element_(nullptr),
+      current_depth_(0) {
+}
+
+bool FeedReader::Read() {
+  // Documents in other encodings are left to the XML parser
+  if (StartsWith("\xEF\xBB\xBF"))
+    pos_ += 3;
+  if (pos_ < end_ && (*pos_ == '\xFE' || *pos_ == '\xFF'))
+    return false;
+  if (memchr(pos_, '\0', end_ - pos_))
+    return false;
+
+  bool root_closed = false;
+
+  while (pos_ < end_) {
+    if (*pos_ != '<') {
+      if (!ReadText())
+        return false;
+    } else if (StartsWith("<?")) {
+      if (!ReadDeclaration())
+        return false;
+    } else if (StartsWith("<!--")) {
+      if (!SkipPast("-->"))
+        return false;
+    } else if (StartsWith("<![CDATA[")) {
+      if (!ReadCData())
+        return false;
+    } else if (StartsWith("<!")) {
+      return false;  // Document type declarations are not supported
+    } else if (StartsWith("</")) {
+      if (!ReadEndTag())
+        return false;
+      if (elements_.empty())
+        root_closed = true;
+    } else {
+      if (root_closed)
+        return false;
+      if (!ReadStartTag())
+        return false;
+    }
+  }
+
+  if (!root_closed || !elements_.empty())
+    return false;
+
+  return Flush();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool FeedReader::IsNameCharacter(char c, bool first) const {
+  if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+      c == '_' || c == ':' || static_cast<unsigned char>(c) >= 0x80)
+    return true;
+  if (!first)
+    return (c >= '0' && c <= '9') || c == '-' || c == '.';
+  return false;
+}
+
+bool FeedReader::IsWhitespace(char c) const {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool FeedReader::StartsWith(const char* str) const {
+  const char* pos = pos_;
+  for ( ; *str; ++str, ++pos)
+    if (pos == end_ || *pos != *str)
+      return false;
+  return true;
+}
+
+bool FeedReader::SkipPast(const char* str) {
+  size_t length = strlen(str);
+  for ( ; pos_ + length <= end_; ++pos_) {
+    if (StartsWith(str)) {
+      pos_ += length;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FeedReader::ReadName(std::string& name) {
+  const char* begin = pos_;
+  if (pos_ == end_ || !IsNameCharacter(*pos_, true))
+    return false;
+  while (pos_ < end_ && IsNameCharacter(*pos_, false))
+    ++pos_;
+  name.assign(begin, pos_);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool FeedReader::ReadCData() {
+  pos_ += 9;  // <![CDATA[
+  const char* begin = pos_;
+  if (!SkipPast("]]>"))
+    return false;
+  if (elements_.empty())
+    return false;
+
+  if (current_element_ && elements_.size() == current_depth_ &&
+      !current_element_->has_value) {
+    // Line endings are normalized, but nothing is unescaped
+    std::string& value = current_element_->value;
+    for (const char* c = begin; c < pos_ - 3; ++c) {
+      if (*c == '\r') {
+        value.push_back('\n');
+        if (c + 1 < pos_ - 3 && c[1] == '\n')
+          ++c;
+      } else {
+        value.push_back(*c);
+      }
+    }
+    current_element_->has_value = true;
+  }
+
+  return true;
+}
+
+bool FeedReader::ReadDeclaration() {
+  const char* begin = pos_;
+  if (!SkipPast("?>"))
+    return false;
+
+  if (begin + 5 <= end_ && std::string(begin, begin + 5) == "<?xml") {
+    std::string declaration(begin, pos_);
+    for (size_t i = 0; i < declaration.size(); i++)
+      declaration[i] = static_cast<char>(tolower(declaration[i]));
+    size_t encoding_pos = declaration.find("encoding");
+    if (encoding_pos != std::string::npos) {
+      size_t value_pos = declaration.find_first_of("\"'", encoding_pos);
+      if (value_pos == std::string::npos ||
+          declaration.compare(value_pos + 1, 5, "utf-8") != 0 ||
+          declaration[value_pos + 6] != declaration[value_pos])
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool FeedReader::ReadEndTag() {
+  pos_ += 2;  // </
+  std::string name;
+  if (!ReadName(name))
+    return false;
+  while (pos_ < end_ && IsWhitespace(*pos_))
+    ++pos_;
+  if (pos_ == end_ || *pos_ != '>')
+    return false;
+  ++pos_;
+
+  if (elements_.empty() || elements_.back() != name)
+    return false;
+
+  if (current_element_ && elements_.size() == current_depth_) {
+    current_element_ = nullptr;
+    current_depth_ = 0;
+  }
+  elements_.pop_back();
+
+  return true;
+}
+
+bool FeedReader::ReadStartTag() {
+  ++pos_;  // <
+  std::string name;
+  if (!ReadName(name))
+    return false;
+
+  elements_.push_back(name);
+
+  // Find out whether we're interested in this element
+  FeedElement* element = nullptr;
+  FeedItemElements* item = nullptr;
+  if (elements_.at(0) == "rss") {
+    if (elements_.size() == 2 && name == "channel") {
+      ++channel_count_;
+    } else if (channel_count_ == 1 && elements_.at(1) == "channel") {
+      if (elements_.size() == 3) {
+        if (name == "item") {
+          items_.resize(items_.size() + 1);
+        } else {
+          element = FindElement(name);
+        }
+      } else if (elements_.size() == 4 && elements_.at(2) == "item") {
+        item = &items_.back();
+        if (name == "title") {
+          element = &item->title;
+        } else if (name == "link") {
+          element = &item->link;
+        } else if (name == "description") {
+          element = &item->description;
+        } else if (name == "category") {
+          element = &item->category;
+        } else if (name == "guid") {
+          element = &item->guid;
+        }
+      }
+    }
+  }
+  if (element && element->found)
+    element = nullptr;  // Only the first element is read
+
+  // Read attributes
+  bool permalink_found = false;
+  while (true) {
+    const char* attribute_begin = pos_;
+    while (pos_ < end_ && IsWhitespace(*pos_))
+      ++pos_;
+    if (pos_ == end_)
+      return false;
+    if (*pos_ == '>') {
+      ++pos_;
+      break;
+    }
+    if (*pos_ == '/') {
+      if (++pos_ == end_ || *pos_ != '>')
+        return false;
+      ++pos_;
+      elements_.pop_back();  // Empty element
+      if (element)
+        element->found = true;
+      return true;
+    }
+
+    // Attributes must be separated by whitespace
+    std::string attribute_name;
+    if (pos_ == attribute_begin || !ReadName(attribute_name))
+      return false;
+    while (pos_ < end_ && IsWhitespace(*pos_))
+      ++pos_;
+    if (pos_ == end_ || *pos_ != '=')
+      return false;
+    ++pos_;
+    while (pos_ < end_ && IsWhitespace(*pos_))
+      ++pos_;
+
+    std::string value;
+    if (!ReadAttributeValue(value))
+      return false;
+
+    if (item && element == &item->guid && attribute_name == "isPermaLink" &&
+        !permalink_found) {
+      item->permalink = !IsEqual(StrToWstr(value), L"false");
+      permalink_found = true;
+    }
+  }
+
+  if (element) {
+    element->found = true;
+    current_element_ = element;
+    current_depth_ = elements_.size();
+  }
+
+  return true;
+}
+
+bool FeedReader::ReadText() {
+  const char* begin = pos_;
+  bool whitespace = true;
+  while (pos_ < end_ && *pos_ != '<') {
+    if (!IsWhitespace(*pos_))
+      whitespace = false;
+    ++pos_;
+  }
+
+  if (whitespace)
+    return true;
+  if (elements_.empty())
+    return false;
+
+  if (current_element_ && elements_.size() == current_depth_ &&
+      !current_element_->has_value) {
+    current_element_->has_value = true;
+    return DecodeText(begin, pos_, current_element_->value);
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool FeedReader::ReadAttributeValue(std::string& value) {
+  if (pos_ == end_ || (*pos_ != '"' && *pos_ != '\''))
+    return false;
+  char quote = *pos_++;
+
+  const char* begin = pos_;
+  while (pos_ < end_ && *pos_ != quote)
+    ++pos_;
+  if (pos_ == end_)
+    return false;
+
+  if (!DecodeText(begin, pos_++, value))
+    return false;
+  for (size_t i = 0; i < value.size(); i++)
+    if (value[i] == '\t' || value[i] == '\n')
+      value[i] = ' ';
+
+  return true;
+}
+
+// Normalizes line endings and replaces predefined entities and character
+// references. Unknown entities are left as they are. Returns false for
+// references that a full XML parser would handle differently.
+bool FeedReader::DecodeText(const char* begin, const char* end,
+                            std::string& output) const {
+  output.reserve(output.size() + (end - begin));
+
+  for (const char* c = begin; c < end; ++c) {
+    if (*c == '\r') {
+      output.push_back('\n');
+      if (c + 1 < end && c[1] == '\n')
+        ++c;
+      continue;
+    }
+    if (*c != '&') {
+      output.push_back(*c);
+      continue;
+    }
+
+    const char* semicolon = c + 1;
+    while (semicolon < end && *semicolon != ';' && *semicolon != '&' &&
+           !IsWhitespace(*semicolon))
+      ++semicolon;
+    if (semicolon == end || *semicolon != ';') {
+      output.push_back(*c);
+      continue;
+    }
+
+    std::string entity(c + 1, semicolon);
+    if (entity == "lt") {
+      output.push_back('<');
+    } else if (entity == "gt") {
+      output.push_back('>');
+    } else if (entity == "amp") {
+      output.push_back('&');
+    } else if (entity == "apos") {
+      output.push_back('\'');
+    } else if (entity == "quot") {
+      output.push_back('"');
+    } else if (entity.size() > 1 && entity[0] == '#') {
+      bool hex = entity[1] == 'x';
+      size_t i = hex ? 2 : 1;
+      if (i == entity.size()) {
+        output.push_back(*c);
+        continue;
+      }
+      unsigned long code_point = 0;
+      for ( ; i < entity.size(); i++) {
+        char digit = entity[i];
+        int value = -1;
+        if (digit >= '0' && digit <= '9') {
+          value = digit - '0';
+        } else if (hex && (digit | ' ') >= 'a' && (digit | ' ') <= 'f') {
+          value = (digit | ' ') - 'a' + 10;
+        }
+        if (value < 0)
+          break;
+        code_point = code_point * (hex ? 16 : 10) + value;
+        if (code_point > 0x10FFFF)
+          return false;
+      }
+      if (i < entity.size()) {
+        output.push_back(*c);
+        continue;
+      }
+      if (code_point == 0 || (code_point >= 0xD800 && code_point <= 0xDFFF))
+        return false;
+      // Encode as UTF-8
+      if (code_point < 0x80) {
+        output.push_back(static_cast<char>(code_point));
+      } else if (code_point < 0x800) {
+        output.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+      } else if (code_point < 0x10000) {
+        output.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+      } else {
+        output.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+      }
+    } else {
+      output.push_back(*c);
+      continue;
+    }
+
+    c = semicolon;
+  }
+
+  return true;
+}
+
+FeedElement* FeedReader::FindElement(const std::string& name) {
+  if (name == "title")
+    return &channel_title_;
+  if (name == "link")
+    return &channel_link_;
+  if (name == "description")
+    return &channel_description_;
+  return nullptr;
+}
+
+bool FeedReader::Flush() {
+  // Conversion of malformed UTF-8 differs from the XML parser
+  auto is_valid = [](const FeedElement& element) {
+    return IsValidUtf8(element.value);
+  };
+  if (!is_valid(channel_title_) || !is_valid(channel_link_) ||
+      !is_valid(channel_description_))
+    return false;
+  for (size_t i = 0; i < items_.size(); i++) {
+    const auto& item = items_.at(i);
+    if (!is_valid(item.title) || !is_valid(item.link) ||
+        !is_valid(item.description) || !is_valid(item.category) ||
+        !is_valid(item.guid))
+      return false;
+  }
+
+  feed_.title = StrToWstr(channel_title_.value);
+  feed_.link = StrToWstr(channel_link_.value);
+  feed_.description = StrToWstr(channel_description_.value);
+
+  feed_.items.clear();
+  feed_.items.resize(items_.size());
+  for (size_t i = 0; i < items_.size(); i++) {
+    auto& item = feed_.items.at(i);
+    item.title = StrToWstr(items_.at(i).title.value);
+    item.link = StrToWstr(items_.at(i).link.value);
+    item.description = StrToWstr(items_.at(i).description.value);
+    item.category = StrToWstr(items_.at(i).category.value);
+    item.guid = StrToWstr(items_.at(i).guid.value);
+    item.permalink = items_.at(i).permalink;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+bool ReadFeedData(const std::string& data, GenericFeed& feed) {
+  FeedReader reader(data, feed);
+  return reader.Read();
+}
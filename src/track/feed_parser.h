@@ -0,0 +1,31 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TAIGA_TRACK_FEED_PARSER_H
+#define TAIGA_TRACK_FEED_PARSER_H
+
+#include <string>
+
+class GenericFeed;
+
+// Reads the channel information and items of an RSS document in a single pass
+// over the raw data, without building a document tree. Returns false if the
+// data can't be handled this way (e.g. it's not UTF-8 or not well-formed), in
+// which case the caller should fall back to a full XML parser.
+bool ReadFeedData(const std::string& data, GenericFeed& feed);
+
+#endif  // TAIGA_TRACK_FEED_PARSER_H
@@ -16,12 +16,14 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "base/foreach.h"
 #include "base/log.h"
 #include "base/string.h"
 #include "library/anime_db.h"
 #include "library/anime_episode.h"
 #include "library/anime_util.h"
 #include "taiga/settings.h"
+#include "taiga/timer.h"
 #include "track/monitor.h"
 #include "track/recognition.h"
 #include "track/search.h"
@@ -50,91 +52,295 @@ static void ChangeAnimeFolder(anime::Item& anime_item,
   ScanAvailableEpisodesQuick(anime_item.GetId());
 }
 
+// Returns true if the path is the folder itself or anything under it
+static bool IsInFolder(const std::wstring& path, const std::wstring& folder) {
+  if (folder.empty() || path.size() < folder.size())
+    return false;
+  if (path.size() == folder.size())
+    return IsEqual(path, folder);
+
+  std::wstring prefix = AddTrailingSlash(folder);
+  return path.size() >= prefix.size() &&
+         IsEqual(path.substr(0, prefix.size()), prefix);
+}
+
+static bool IsRootFolder(const std::wstring& folder) {
+  foreach_(it, Settings.root_folders)
+    if (IsEqual(*it, folder) || IsEqual(AddTrailingSlash(*it), folder))
+      return true;
+
+  return false;
+}
+
+static const track::recognition::MatchOptions& GetMatchOptions() {
+  static track::recognition::MatchOptions match_options;
+  match_options.check_airing_date = false;
+  match_options.check_anime_type = false;
+  match_options.validate_episode_number = false;
+
+  return match_options;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void FolderMonitor::HandleChangeNotification(
-    const DirectoryChangeNotification& notification) const {
+    const DirectoryChangeNotification& notification) {
+  bool directory = false;
+
   switch (notification.type) {
     case DirectoryChangeNotification::kTypeDirectory:
-      OnDirectory(notification);
+      directory = true;
       break;
     case DirectoryChangeNotification::kTypeFile:
-      OnFile(notification);
       break;
     default:
       LOG(LevelDebug, L"Unknown change type\n"
                       L"Path: " + notification.path + L"\n"
                       L"Filename: " + notification.filename.first);
+      return;
+  }
+
+  std::wstring path = notification.path + notification.filename.first;
+
+  switch (notification.action) {
+    case FILE_ACTION_ADDED:
+      queue_.Add(FileChangeQueue::kAdded, directory, path);
+      break;
+    case FILE_ACTION_REMOVED:
+      queue_.Add(FileChangeQueue::kRemoved, directory, path);
+      break;
+    case FILE_ACTION_RENAMED_NEW_NAME:
+      if (notification.filename.second.empty()) {
+        queue_.Add(FileChangeQueue::kAdded, directory, path);
+      } else {
+        queue_.Add(FileChangeQueue::kRenamed, directory, path,
+                   notification.path + notification.filename.second);
+      }
       break;
+    default:
+      return;
+  }
+
+  // Changes are handled once they stop arriving
+  taiga::timers.timer(taiga::kTimerMonitor)->Reset();
+}
+
+void FolderMonitor::HandleOverflow(const std::wstring& path) {
+  queue_.SetOverflow();
+
+  taiga::timers.timer(taiga::kTimerMonitor)->Reset();
+}
+
+void FolderMonitor::ProcessChanges() {
+  if (queue_.IsEmpty())
+    return;
+
+  std::vector<FileChangeQueue::Change> changes;
+
+  if (queue_.Take(changes)) {
+    LOG(LevelWarning, L"Some changes were lost, scanning all folders.");
+    ScanAvailableEpisodes(true);
+    return;
+  }
+
+  // Added files are parsed and identified together, so that a burst of new
+  // files can be recognized using all processors. Changes are still handled
+  // in order.
+  std::vector<anime::Episode> episodes(changes.size());
+  std::vector<anime::Episode> batch;
+  std::vector<size_t> indexes;
+
+  for (size_t i = 0; i < changes.size(); ++i) {
+    const auto& change = changes.at(i);
+    if (change.directory || change.action == FileChangeQueue::kRemoved)
+      continue;
+    if (Meow.Parse(change.path, episodes.at(i))) {
+      indexes.push_back(i);
+      batch.push_back(episodes.at(i));
+    }
+  }
+
+  Meow.IdentifyBatch(batch, GetMatchOptions());
+
+  for (size_t i = 0; i < indexes.size(); ++i)
+    episodes.at(indexes.at(i)) = batch.at(i);
+
+  for (size_t i = 0; i < changes.size(); ++i) {
+    if (changes.at(i).directory) {
+      OnDirectory(changes.at(i));
+    } else {
+      OnFile(changes.at(i), episodes.at(i));
+    }
   }
 }
 
-static anime::Item* FindAnimeItem(const DirectoryChangeNotification& notification,
+////////////////////////////////////////////////////////////////////////////////
+
+static anime::Item* FindAnimeItem(const std::wstring& path,
                                   anime::Episode& episode) {
-  if (!Meow.Parse(notification.path + notification.filename.first, episode))
+  if (!Meow.Parse(path, episode))
     return nullptr;
 
-  static track::recognition::MatchOptions match_options;
-  match_options.check_airing_date = false;
-  match_options.check_anime_type = false;
-  match_options.validate_episode_number = false;
-
-  auto anime_id = Meow.Identify(episode, false, match_options);
+  auto anime_id = Meow.Identify(episode, false, GetMatchOptions());
 
   return AnimeDatabase.FindItem(anime_id);
 }
 
-void FolderMonitor::OnDirectory(const DirectoryChangeNotification& notification) const {
-  anime::Item* anime_item = nullptr;
+// Files are identified by their own titles first, e.g. a file of a sequel
+// may be in the folder of the first season. The anime whose folder contains
+// the file is only used when its title is close enough to the parsed one.
+static anime::Item* FindFolderOwner(const std::wstring& path,
+                                    anime::Episode& episode) {
+  auto anime_item = AnimeDatabase.FindItemByFolder(path);
 
-  bool new_path_available = notification.action != FILE_ACTION_REMOVED;
-  bool old_path_available = notification.action >= FILE_ACTION_REMOVED;
+  // Root folders may be set as anime folders, but they're shared with other
+  // anime
+  if (!anime_item || IsRootFolder(anime_item->GetFolder()))
+    return nullptr;
+
+  if (Meow.Identify(episode, true, GetMatchOptions()) != anime_item->GetId())
+    return nullptr;
 
-  if (old_path_available) {
-    std::wstring old_path = notification.path;
-    old_path += notification.action == FILE_ACTION_REMOVED ?
-        notification.filename.first : notification.filename.second;
-    for (auto& item : AnimeDatabase.items) {
-      if (IsEqual(item.second.GetFolder(), old_path)) {
-        anime_item = &item.second;
+  return anime_item;
+}
+
+static void OnFolderAdded(const std::wstring& path) {
+  anime::Episode episode;
+  auto anime_item = FindAnimeItem(path, episode);
+
+  if (anime_item) {
+    ChangeAnimeFolder(*anime_item, path);
+  } else {
+    // Might contain anime folders or episodes that we don't know about
+    ScanAvailableEpisodesInFolder(path);
+  }
+}
+
+static void OnFolderRemoved(const std::wstring& path) {
+  std::vector<anime::PathIndex::Owner> owners;
+  AnimeDatabase.path_index().FindAll(path, owners);
+
+  bool folder_changed = false;
+
+  foreach_(owner, owners) {
+    auto anime_item = AnimeDatabase.FindItem(owner->anime_id);
+    if (!anime_item)
+      continue;
+    switch (owner->key) {
+      case anime::PathIndex::kKeyFolder:
+        LOG(LevelDebug, L"Anime folder removed: " + anime_item->GetTitle() + L"\n"
+                        L"Path: " + anime_item->GetFolder());
+        anime_item->SetFolder(L"");
+        folder_changed = true;
+        break;
+      case anime::PathIndex::kKeyNextEpisode:
+        anime_item->SetNextEpisodePath(L"");
+        break;
+      default:
+        anime_item->SetEpisodeAvailability(owner->key, false, L"");
         break;
-      }
     }
-    if (anime_item) {
-      std::wstring new_path = notification.path + notification.filename.first;
-      ChangeAnimeFolder(*anime_item, new_path_available ? new_path : L"");
-      return;
+  }
+
+  if (folder_changed)
+    Settings.Save();
+}
+
+// Paths under the folder are updated without scanning it again
+static void OnFolderRenamed(const std::wstring& old_path,
+                            const std::wstring& new_path) {
+  const auto& path_index = AnimeDatabase.path_index();
+  std::vector<anime::PathIndex::Owner> owners;
+  path_index.FindAll(old_path, owners);
+
+  bool folder_changed = false;
+
+  foreach_(owner, owners) {
+    auto anime_item = AnimeDatabase.FindItem(owner->anime_id);
+    if (!anime_item)
+      continue;
+    std::wstring path = path_index.GetPath(owner->anime_id, owner->key);
+    if (!IsInFolder(path, old_path))
+      continue;
+    path = new_path + path.substr(old_path.size());
+    switch (owner->key) {
+      case anime::PathIndex::kKeyFolder:
+        anime_item->SetFolder(path);
+        LOG(LevelDebug, L"Anime folder moved: " + anime_item->GetTitle() + L"\n"
+                        L"Path: " + anime_item->GetFolder());
+        folder_changed = true;
+        break;
+      case anime::PathIndex::kKeyNextEpisode:
+        anime_item->SetNextEpisodePath(path);
+        break;
+      default:
+        anime_item->SetEpisodeAvailability(owner->key, true, path);
+        break;
     }
   }
 
-  if (new_path_available) {
-    anime::Episode episode;
-    anime_item = FindAnimeItem(notification, episode);
-    if (anime_item)
-      ChangeAnimeFolder(*anime_item, episode.folder + episode.file);
+  if (folder_changed) {
+    Settings.Save();
+  } else {
+    // The folder might have been renamed after an anime title
+    OnFolderAdded(new_path);
   }
 }
 
-void FolderMonitor::OnFile(const DirectoryChangeNotification& notification) const {
-  anime::Episode episode;
-  auto anime_item = FindAnimeItem(notification, episode);
+void FolderMonitor::OnDirectory(const FileChangeQueue::Change& change) {
+  switch (change.action) {
+    case FileChangeQueue::kAdded:
+      OnFolderAdded(change.path);
+      break;
+    case FileChangeQueue::kRemoved:
+      OnFolderRemoved(change.path);
+      break;
+    case FileChangeQueue::kRenamed:
+      OnFolderRenamed(change.old_path, change.path);
+      break;
+  }
+}
 
-  if (!anime_item)
+void FolderMonitor::OnFile(const FileChangeQueue::Change& change,
+                           anime::Episode& episode) {
+  // Removed files are looked up by their paths, without parsing them
+  if (change.action == FileChangeQueue::kRemoved) {
+    std::vector<anime::PathIndex::Owner> owners;
+    AnimeDatabase.path_index().Find(change.path, owners);
+    foreach_(owner, owners) {
+      auto anime_item = AnimeDatabase.FindItem(owner->anime_id);
+      if (!anime_item || owner->key <= 0)
+        continue;
+      if (anime_item->SetEpisodeAvailability(owner->key, false, L"")) {
+        LOG(LevelDebug, anime_item->GetTitle() + L" #" + ToWstr(owner->key) +
+                        L" is unavailable.");
+      }
+    }
     return;
+  }
 
-  bool path_available = notification.action != FILE_ACTION_REMOVED;
+  anime::Item* anime_item = AnimeDatabase.FindItem(episode.anime_id);
+
+  if (!anime_item) {
+    if (episode.normal_title.empty())
+      return;
+    anime_item = FindFolderOwner(change.path, episode);
+    if (!anime_item)
+      return;
+  }
 
   // Set anime folder
-  if (path_available && anime_item->GetFolder().empty()) {
+  if (anime_item->GetFolder().empty()) {
     ChangeAnimeFolder(*anime_item, episode.folder);
   }
 
   // Set episode availability
-  int lower_bound = anime::GetEpisodeHigh(episode.number);
-  int upper_bound = anime::GetEpisodeLow(episode.number);
-  std::wstring path = notification.path + notification.filename.first;
+  int lower_bound = anime::GetEpisodeLow(episode.number);
+  int upper_bound = anime::GetEpisodeHigh(episode.number);
   for (int number = lower_bound; number <= upper_bound; ++number) {
-    if (anime_item->SetEpisodeAvailability(number, path_available, path)) {
-      LOG(LevelDebug, anime_item->GetTitle() + L" #" + ToWstr(number) + L" is " +
-          (path_available ? L"available." : L"unavailable."));
+    if (anime_item->SetEpisodeAvailability(number, true, change.path)) {
+      LOG(LevelDebug, anime_item->GetTitle() + L" #" + ToWstr(number) +
+                      L" is available.");
     }
   }
 }
\ No newline at end of file
@@ -19,16 +19,27 @@
 #ifndef TAIGA_TRACK_MONITOR_H
 #define TAIGA_TRACK_MONITOR_H
 
+#include "base/file_change_queue.h"
 #include "base/file_monitor.h"
+#include "library/anime_episode.h"
 
+// Keeps available episodes up to date as files are added, renamed or removed.
+// Changes are handled once they stop arriving for a few seconds.
 class FolderMonitor : public DirectoryMonitor {
 public:
   void Enable(bool enabled = true);
-  void HandleChangeNotification(const DirectoryChangeNotification& notification) const;
+  void HandleChangeNotification(const DirectoryChangeNotification& notification);
+  void HandleOverflow(const std::wstring& path);
+
+  // Called by the timer
+  void ProcessChanges();
 
 private:
-  void OnDirectory(const DirectoryChangeNotification& notification) const;
-  void OnFile(const DirectoryChangeNotification& notification) const;
+  void OnDirectory(const FileChangeQueue::Change& change);
+  // The episode is parsed and identified beforehand, unless it was removed
+  void OnFile(const FileChangeQueue::Change& change, anime::Episode& episode);
+
+  FileChangeQueue queue_;
 };
 
 extern class FolderMonitor FolderMonitor;
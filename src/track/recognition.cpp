@@ -17,6 +17,8 @@
 */
 
 #include <algorithm>
+#include <functional>
+#include <memory>
 
 #include <anitomy/anitomy/anitomy.h>
 #include <libmojibake/mojibake.h>
@@ -29,12 +31,151 @@
 #include "library/anime_util.h"
 #include "taiga/settings.h"
 #include "track/recognition.h"
+#include "win/win_thread.h"
 
 track::recognition::Engine Meow;
 
 namespace track {
 namespace recognition {
 
+namespace {
+
+// Normalization rules, in the order they are applied. Whole words are replaced.
+struct WordRule {
+  const wchar_t* word;
+  const wchar_t* replacement;
+};
+
+// We skip 1 and 10 to avoid matching "I" and "X", as they're unlikely to be
+// used as Roman numerals. Any number above "XIII" is rarely used in anime
+// titles, which is why we don't need an actual Roman-to-Arabic number
+// conversion algorithm.
+const WordRule kRomanNumbers[] = {
+  {L"II", L"2"}, {L"III", L"3"}, {L"IV", L"4"}, {L"V", L"5"},
+  {L"VI", L"6"}, {L"VII", L"7"}, {L"VIII", L"8"}, {L"IX", L"9"},
+  {L"XI", L"11"}, {L"XII", L"12"}, {L"XIII", L"13"},
+};
+
+// Romanizations (Hepburn to Wapuro)
+const WordRule kRomanizations[] = {
+  {L"wa", L"ha"}, {L"e", L"he"}, {L"o", L"wo"},
+};
+
+const WordRule kOrdinalNumbers[] = {
+  {L"first", L"1st"}, {L"second", L"2nd"}, {L"third", L"3rd"},
+  {L"fourth", L"4th"}, {L"fifth", L"5th"}, {L"sixth", L"6th"},
+  {L"seventh", L"7th"}, {L"eighth", L"8th"}, {L"ninth", L"9th"},
+};
+
+// Each value is followed by its patterns. This works considerably faster than
+// regular expressions.
+const int kSeasonPatternCount = 4;
+const wchar_t* const kSeasonNumbers[][kSeasonPatternCount] = {
+  {L"1", L"1st season", L"season 1", L"s1"},
+  {L"2", L"2nd season", L"season 2", L"s2"},
+  {L"3", L"3rd season", L"season 3", L"s3"},
+  {L"4", L"4th season", L"season 4", L"s4"},
+  {L"5", L"5th season", L"season 5", L"s5"},
+  {L"6", L"6th season", L"season 6", L"s6"},
+};
+
+const WordRule kUnnecessaryWords[] = {
+  {L"&", L"and"}, {L"the", L""}, {L"episode", L""}, {L"specials", L"special"},
+};
+
+const int kUnicodeOptions =
+    // NFKC normalization according to Unicode Standard Annex #15
+    UTF8PROC_COMPAT | UTF8PROC_COMPOSE | UTF8PROC_STABLE |
+    // Strip "default ignorable" characters, control characters, character
+    // marks (accents, diaeresis)
+    UTF8PROC_IGNORE | UTF8PROC_STRIPCC | UTF8PROC_STRIPMARK |
+    // Map certain characters (e.g. hyphen and minus) for easier comparison
+    UTF8PROC_LUMP |
+    // Perform unicode case folding for case-insensitive comparison
+    UTF8PROC_CASEFOLD;
+
+bool IsPunctuation(wchar_t c) {
+  // Control codes, white-space and punctuation characters
+  if (c <= 255 && !isalnum(c))
+    return true;
+  // Unicode stars, hearts, notes, etc. (0x2000-0x2767)
+  if (c > 8192 && c < 10087)
+    return true;
+  // Valid character
+  return false;
+}
+
+// Marks the empty slots of a TitleTable
+const unsigned int kEmptyEntry = 0xFFFFFFFF;
+
+unsigned int HashTitle(const wchar_t* title, size_t length) {
+  // FNV-1a
+  unsigned int hash = 2166136261U;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned int>(title[i]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+// Titles are combined into the title signature of the engine by addition, so
+// that they can be removed in any order
+UINT64 HashIndexedTitle(int anime_id, TitleType type, const std::wstring& title) {
+  // FNV-1a
+  UINT64 hash = 14695981039346656037ULL;
+  auto combine = [&hash](unsigned int value) {
+    hash ^= value;
+    hash *= 1099511628211ULL;
+  };
+  combine(static_cast<unsigned int>(anime_id));
+  combine(static_cast<unsigned int>(type));
+  for (const auto& c : title)
+    combine(static_cast<unsigned int>(c));
+  return hash;
+}
+
+UINT64 GetCharacterMask(const std::wstring& str) {
+  UINT64 mask = 0;
+  for (const auto& c : str)
+    mask |= 1ULL << (c % 64);
+  return mask;
+}
+
+// Episodes are identified one by one on the calling thread, unless there are
+// enough of them to make it worth creating threads.
+const size_t kBatchMinItemsPerWorker = 32;
+
+class BatchWorker : public win::Thread {
+public:
+  typedef std::function<void(size_t, TrigramIndex::Buffer&,
+                             sorted_scores_t&)> job_t;
+
+  BatchWorker(const job_t& job, size_t count, volatile LONG& next_index)
+      : job_(job), count_(count), next_index_(next_index) {}
+
+  DWORD ThreadProc() {
+    for (;;) {
+      size_t index = static_cast<size_t>(InterlockedIncrement(&next_index_) - 1);
+      if (index >= count_)
+        break;
+      job_(index, trigram_buffer_, scores_);
+    }
+    return 0;
+  }
+
+private:
+  const job_t& job_;
+  const size_t count_;
+  volatile LONG& next_index_;
+  // Scratch space, not shared with other workers
+  TrigramIndex::Buffer trigram_buffer_;
+  sorted_scores_t scores_;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
 MatchOptions::MatchOptions()
     : allow_sequels(false),
       check_airing_date(false),
@@ -121,12 +262,70 @@ bool Engine::Parse(std::wstring title, anime::Episode& episode) const {
   return !episode.normal_title.empty();
 }
 
+Engine::Engine()
+    : title_signature_(0),
+      titles_initialized_(false) {
+}
+
 int Engine::Identify(anime::Episode& episode, bool give_score,
                      const MatchOptions& match_options) {
+  InitializeTitles();
+
+  return IdentifyEpisode(episode, give_score, match_options, trigram_buffer_,
+                         scores_);
+}
+
+void Engine::IdentifyBatch(std::vector<anime::Episode>& episodes,
+                           const MatchOptions& match_options,
+                           bool give_score) {
+  if (episodes.empty())
+    return;
+
+  // Titles are shared between threads, so they must be ready beforehand
+  InitializeTitles();
+
+  BatchWorker::job_t job =
+      [&](size_t index, TrigramIndex::Buffer& trigram_buffer,
+          sorted_scores_t& scores) {
+        IdentifyEpisode(episodes.at(index), give_score, match_options,
+                        trigram_buffer, scores);
+      };
+
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+
+  size_t worker_count = min(static_cast<size_t>(system_info.dwNumberOfProcessors),
+                            episodes.size() / kBatchMinItemsPerWorker);
+  worker_count = min(worker_count, static_cast<size_t>(MAXIMUM_WAIT_OBJECTS));
+
+  volatile LONG next_index = 0;
+  std::vector<std::unique_ptr<BatchWorker>> workers;
+  std::vector<HANDLE> handles;
+
+  // The calling thread is one of the workers
+  for (size_t i = 1; i < worker_count; ++i) {
+    std::unique_ptr<BatchWorker> worker(
+        new BatchWorker(job, episodes.size(), next_index));
+    if (!worker->CreateThread(nullptr, 0, 0))
+      break;
+    handles.push_back(worker->GetThreadHandle());
+    workers.push_back(std::move(worker));
+  }
+
+  BatchWorker(job, episodes.size(), next_index).ThreadProc();
+
+  if (!handles.empty())
+    WaitForMultipleObjects(static_cast<DWORD>(handles.size()), &handles.front(),
+                           TRUE, INFINITE);
+}
+
+int Engine::IdentifyEpisode(anime::Episode& episode, bool give_score,
+                            const MatchOptions& match_options,
+                            TrigramIndex::Buffer& trigram_buffer,
+                            sorted_scores_t& scores) const {
   std::set<int> anime_ids;
 
   // Look up the title in our database
-  InitializeTitles();
   LookUpTitle(episode.title, episode.normal_title, anime_ids);
 
   // Validate IDs
@@ -142,9 +341,9 @@ int Engine::Identify(anime::Episode& episode, bool give_score,
   if (anime_ids.size() == 1) {
     episode.anime_id = *anime_ids.begin();
   } else if (anime_ids.size() > 1) {
-    episode.anime_id = ScoreTitle(episode, anime_ids);
+    episode.anime_id = ScoreTitle(episode, anime_ids, trigram_buffer, scores);
   } else if (anime_ids.empty() && give_score) {
-    episode.anime_id = ScoreTitle(episode, anime_ids);
+    episode.anime_id = ScoreTitle(episode, anime_ids, trigram_buffer, scores);
   }
 
   // Post-processing
@@ -217,41 +416,140 @@ int Engine::ValidateEpisodeNumber(anime::Episode& episode,
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::InitializeTitles() {
-  static bool initialized = false;
-
-  if (initialized)
+  if (titles_initialized_)
     return;
-  initialized = true;
+  titles_initialized_ = true;
 
   for (const auto& it : AnimeDatabase.items)
     UpdateTitles(it.second);
 }
 
 void Engine::UpdateTitles(const anime::Item& anime_item) {
-  auto update_title = [&](std::wstring title,
-                          title_container_t& titles,
-                          title_container_t& normal_titles) {
-    if (!title.empty()) {
-      titles[title.c_str()].insert(anime_item.GetId());
-
-      trigram_container_t trigrams;
-      GetTrigrams(ToLower_Copy(title), trigrams);
-      trigrams_[anime_item.GetId()].push_back(trigrams);
-
-      Normalize(title);
-      normal_titles[title.c_str()].insert(anime_item.GetId());
-    }
+  const int anime_id = anime_item.GetId();
+
+  std::vector<std::pair<std::wstring, TitleType>> titles;
+  auto insert_title = [&titles](const std::wstring& title, TitleType type) {
+    if (!title.empty())
+      titles.push_back(std::make_pair(title, type));
   };
 
-  update_title(anime_item.GetTitle(), titles_.main, normal_titles_.main);
-  update_title(anime_item.GetEnglishTitle(), titles_.main, normal_titles_.main);
+  insert_title(anime_item.GetTitle(), kTitleTypeMain);
+  insert_title(anime_item.GetEnglishTitle(), kTitleTypeMain);
 
   for (const auto& synonym : anime_item.GetSynonyms()) {
-    update_title(synonym, titles_.alternative, normal_titles_.alternative);
+    insert_title(synonym, kTitleTypeAlternative);
   }
   for (const auto& synonym : anime_item.GetUserSynonyms()) {
-    update_title(synonym, titles_.user, normal_titles_.user);
+    insert_title(synonym, kTitleTypeUser);
   }
+
+  auto& indexed_titles = indexed_titles_[anime_id];
+  std::vector<IndexedTitle> new_indexed_titles;
+  new_indexed_titles.reserve(titles.size());
+
+  for (const auto& title : titles) {
+    auto it = std::find_if(indexed_titles.begin(), indexed_titles.end(),
+        [&title](const IndexedTitle& indexed_title) {
+          return indexed_title.type == title.second &&
+                 indexed_title.title == title.first;
+        });
+    if (it != indexed_titles.end()) {
+      new_indexed_titles.push_back(*it);
+      indexed_titles.erase(it);
+    } else {
+      new_indexed_titles.push_back(AddTitle(anime_id, title.first, title.second));
+    }
+  }
+
+  // Whatever is left is no longer a title of the item
+  for (const auto& indexed_title : indexed_titles)
+    RemoveTitle(anime_id, indexed_title);
+
+  if (new_indexed_titles.empty()) {
+    indexed_titles_.erase(anime_id);
+  } else {
+    indexed_titles.swap(new_indexed_titles);
+  }
+}
+
+void Engine::Clear() {
+  titles_ = TitleTable();
+  normal_titles_ = TitleTable();
+  indexed_titles_.clear();
+  trigram_index_ = TrigramIndex();
+  title_signature_ = 0;
+  titles_initialized_ = false;
+}
+
+void Engine::RemoveItem(int anime_id) {
+  auto it = indexed_titles_.find(anime_id);
+
+  if (it == indexed_titles_.end())
+    return;
+
+  for (const auto& indexed_title : it->second)
+    RemoveTitle(anime_id, indexed_title);
+
+  indexed_titles_.erase(it);
+}
+
+Engine::IndexedTitle Engine::AddTitle(int anime_id, const std::wstring& title,
+                                      TitleType type) {
+  IndexedTitle indexed_title;
+  indexed_title.title = title;
+  indexed_title.type = type;
+
+  titles_.Add(title, type, anime_id);
+  title_signature_ += HashIndexedTitle(anime_id, type, title);
+
+  auto& profile = indexed_title.profile;
+  profile.title = ToLower_Copy(title);
+  profile.character_mask = GetCharacterMask(profile.title);
+
+  trigram_container_t trigrams;
+  GetTrigrams(profile.title, trigrams);
+  indexed_title.trigram_title = trigram_index_.Add(anime_id, trigrams);
+
+  indexed_title.normal_title = title;
+  normalizer_.Normalize(indexed_title.normal_title, normalizer_buffer_);
+  normal_titles_.Add(indexed_title.normal_title, type, anime_id);
+
+  return indexed_title;
+}
+
+void Engine::RemoveTitle(int anime_id, const IndexedTitle& indexed_title) {
+  titles_.Remove(indexed_title.title, indexed_title.type, anime_id);
+  title_signature_ -= HashIndexedTitle(anime_id, indexed_title.type,
+                                       indexed_title.title);
+  normal_titles_.Remove(indexed_title.normal_title, indexed_title.type, anime_id);
+
+  trigram_container_t trigrams;
+  GetTrigrams(indexed_title.profile.title, trigrams);
+  trigram_index_.Remove(indexed_title.trigram_title, trigrams);
+}
+
+UINT64 Engine::GetTitleSignature() {
+  InitializeTitles();
+
+  return title_signature_;
+}
+
+IndexSize Engine::GetIndexSize() const {
+  IndexSize size;
+
+  size.anime = indexed_titles_.size();
+  size.titles = 0;
+  for (const auto& it : indexed_titles_)
+    size.titles += it.second.size();
+  size.title_entries = titles_.entry_count();
+  size.title_ids = titles_.node_count();
+  size.normal_title_entries = normal_titles_.entry_count();
+  size.normal_title_ids = normal_titles_.node_count();
+  size.trigram_titles = trigram_index_.title_count();
+  size.trigrams = trigram_index_.trigram_count();
+  size.trigram_postings = trigram_index_.posting_count();
+
+  return size;
 }
 
 int Engine::LookUpTitle(const std::wstring& title,
@@ -259,28 +557,28 @@ int Engine::LookUpTitle(const std::wstring& title,
                         std::set<int>& anime_ids) const {
   int anime_id = anime::ID_UNKNOWN;
 
-  auto find_title = [&](const std::wstring& title,
-                        const title_container_t& container) {
+  auto find_title = [&](const TitleTable& table, const TitleTable::Entry* entry,
+                        TitleType type) {
     if (!anime::IsValidId(anime_id)) {
-      auto it = container.find(title.c_str());
-      if (it != container.end()) {
-        anime_ids.insert(it->second.begin(), it->second.end());
+      if (table.GetIds(entry, type, anime_ids)) {
         if (anime_ids.size() == 1)
           anime_id = *anime_ids.begin();
       }
     }
   };
 
-  find_title(title, titles_.user);
-  find_title(title, titles_.main);
-  find_title(title, titles_.alternative);
+  auto entry = titles_.Find(title);
+  find_title(titles_, entry, kTitleTypeUser);
+  find_title(titles_, entry, kTitleTypeMain);
+  find_title(titles_, entry, kTitleTypeAlternative);
 
   if (anime_ids.size() == 1)
     return anime_id;
 
-  find_title(normal_title, normal_titles_.user);
-  find_title(normal_title, normal_titles_.main);
-  find_title(normal_title, normal_titles_.alternative);
+  entry = normal_titles_.Find(normal_title);
+  find_title(normal_titles_, entry, kTitleTypeUser);
+  find_title(normal_titles_, entry, kTitleTypeMain);
+  find_title(normal_titles_, entry, kTitleTypeAlternative);
 
   return anime_id;
 }
@@ -288,128 +586,557 @@ int Engine::LookUpTitle(const std::wstring& title,
 ////////////////////////////////////////////////////////////////////////////////
 
 void Engine::Normalize(std::wstring& title) const {
-  ConvertRomanNumbers(title);
-  Transliterate(title);
-  NormalizeUnicode(title);  // Title is lower case after this point, due to UTF8PROC_CASEFOLD
-  ConvertOrdinalNumbers(title);
-  ConvertSeasonNumbers(title);
-  EraseUnnecessary(title);
-  ErasePunctuation(title);
-}
-
-void Engine::ConvertOrdinalNumbers(std::wstring& str) const {
-  static const std::vector<std::pair<std::wstring, std::wstring>> ordinals{
-    {L"1st", L"first"}, {L"2nd", L"second"}, {L"3rd", L"third"},
-    {L"4th", L"fourth"}, {L"5th", L"fifth"}, {L"6th", L"sixth"},
-    {L"7th", L"seventh"}, {L"8th", L"eighth"}, {L"9th", L"ninth"},
-  };
+  normalizer_.Normalize(title, normalizer_buffer_);
+}
 
-  for (const auto& ordinal : ordinals)
-    ReplaceString(str, 0, ordinal.second, ordinal.first, true, true);
+////////////////////////////////////////////////////////////////////////////////
+
+void Normalizer::WordMap::Add(const std::wstring& word,
+                              const std::wstring& replacement) {
+  if (words_.size() <= word.size())
+    words_.resize(word.size() + 1);
+  words_[word.size()].push_back(std::make_pair(word, replacement));
 }
 
-void Engine::ConvertRomanNumbers(std::wstring& str) const {
-  // We skip 1 and 10 to avoid matching "I" and "X", as they're unlikely to be
-  // used as Roman numerals. Any number above "XIII" is rarely used in anime
-  // titles, which is why we don't need an actual Roman-to-Arabic number
-  // conversion algorithm.
-  static const std::vector<std::pair<std::wstring, std::wstring>> numerals{
-    {L"2", L"II"}, {L"3", L"III"}, {L"4", L"IV"}, {L"5", L"V"},
-    {L"6", L"VI"}, {L"7", L"VII"}, {L"8", L"VIII"}, {L"9", L"IX"},
-    {L"11", L"XI"}, {L"12", L"XII"}, {L"13", L"XIII"},
-  };
+const std::wstring* Normalizer::WordMap::Find(const wchar_t* word,
+                                              size_t length) const {
+  if (length >= words_.size())
+    return nullptr;
 
-  for (const auto& numeral : numerals)
-    ReplaceString(str, 0, numeral.second, numeral.first, true, true);
+  for (const auto& pair : words_[length])
+    if (std::char_traits<wchar_t>::compare(pair.first.data(), word, length) == 0)
+      return &pair.second;
+
+  return nullptr;
 }
 
-void Engine::ConvertSeasonNumbers(std::wstring& str) const {
-  // This works considerably faster than regular expressions.
-  typedef std::vector<std::wstring> season_t;
-  static const std::vector<std::pair<std::wstring, season_t>> values{
-    {L"1", {L"1st season", L"season 1", L"s1"}},
-    {L"2", {L"2nd season", L"season 2", L"s2"}},
-    {L"3", {L"3rd season", L"season 3", L"s3"}},
-    {L"4", {L"4th season", L"season 4", L"s4"}},
-    {L"5", {L"5th season", L"season 5", L"s5"}},
-    {L"6", {L"6th season", L"season 6", L"s6"}},
-  };
+Normalizer::Normalizer()
+    : season_word_(L"season") {
+  for (const auto& numeral : kRomanNumbers)
+    roman_numbers_.Add(numeral.word, numeral.replacement);
+  for (const auto& romanization : kRomanizations)
+    romanizations_.Add(romanization.word, romanization.replacement);
+  for (const auto& ordinal : kOrdinalNumbers)
+    ordinal_numbers_.Add(ordinal.word, ordinal.replacement);
+  for (const auto& word : kUnnecessaryWords)
+    unnecessary_words_.Add(word.word, word.replacement);
+
+  // Patterns are kept in the same order as they're applied by ReplaceString,
+  // because the result of one can be matched by another. Single words (e.g.
+  // "s1") are also put in a map, which is enough when there is no "season".
+  for (const auto& value : kSeasonNumbers) {
+    for (int i = 1; i < kSeasonPatternCount; ++i) {
+      SeasonRule rule;
+      Split(value[i], L" ", rule.words);
+      rule.value = value[0];
+      if (rule.words.size() == 1)
+        season_numbers_.Add(rule.words.front(), rule.value);
+      season_rules_.push_back(rule);
+    }
+  }
+}
+
+void Normalizer::Normalize(std::wstring& title, Buffer& buffer) const {
+  Transliterate(title, buffer.text);
+  // Title is lower case after this point, due to UTF8PROC_CASEFOLD
+  NormalizeUnicode(buffer.text, buffer.normal_text, buffer.codepoints);
+
+  auto& words = buffer.words;
+  words.clear();
+  bool has_season_word = false;
+
+  const std::wstring& text = buffer.normal_text;
+  for (size_t pos = 0; pos <= text.size(); ) {
+    size_t end = text.find(L' ', pos);
+    if (end == std::wstring::npos)
+      end = text.size();
+    Buffer::Word word = {text.data() + pos, end - pos};
+    auto ordinal = ordinal_numbers_.Find(word.data, word.length);
+    if (ordinal) {
+      word.data = ordinal->data();
+      word.length = ordinal->size();
+    } else if (word.length == season_word_.size() &&
+               std::char_traits<wchar_t>::compare(season_word_.data(), word.data,
+                                                  word.length) == 0) {
+      has_season_word = true;
+    }
+    words.push_back(word);
+    pos = end + 1;
+  }
+
+  if (has_season_word) {
+    ConvertSeasonNumbers(words);
+  } else {
+    for (auto& word : words) {
+      auto value = season_numbers_.Find(word.data, word.length);
+      if (value) {
+        word.data = value->data();
+        word.length = value->size();
+      }
+    }
+  }
+
+  // White-space is erased along with punctuation, so words are simply joined
+  title.clear();
+  for (const auto& word : words) {
+    const wchar_t* data = word.data;
+    size_t length = word.length;
+    auto replacement = unnecessary_words_.Find(data, length);
+    if (replacement) {
+      data = replacement->data();
+      length = replacement->size();
+    }
+    for (size_t i = 0; i < length; ++i)
+      if (!IsPunctuation(data[i]))
+        title.push_back(data[i]);
+  }
+}
+
+void Normalizer::Transliterate(const std::wstring& input,
+                               std::wstring& output) const {
+  output.clear();
+
+  for (size_t pos = 0; pos <= input.size(); ) {
+    size_t end = input.find(L' ', pos);
+    if (end == std::wstring::npos)
+      end = input.size();
+    if (pos > 0)
+      output.push_back(L' ');
+
+    // Roman numerals are matched before transliteration
+    auto numeral = roman_numbers_.Find(input.data() + pos, end - pos);
+    if (numeral) {
+      output.append(*numeral);
+    } else {
+      const size_t word_pos = output.size();
+      for (size_t i = pos; i < end; ++i) {
+        const wchar_t c = input[i];
+        switch (c) {
+          case L'\u00D7': output.push_back(L'x'); break;  // multiplication sign
+          case L'\u014C': output.append(L"ou"); break;
+          case L'\u014D': output.append(L"ou"); break;
+          case L'\u016B': output.append(L"uu"); break;
+          default: output.push_back(c); break;
+        }
+      }
+      auto romanization = romanizations_.Find(output.data() + word_pos,
+                                              output.size() - word_pos);
+      if (romanization) {
+        output.resize(word_pos);
+        output.append(*romanization);
+      }
+    }
+
+    pos = end + 1;
+  }
+}
+
+// Same as utf8proc_map, except that the input is read from and the output is
+// written to UTF-16 strings directly, rather than being converted to UTF-8 and
+// back. Decomposition is done into a buffer that is reused between calls.
+void Normalizer::NormalizeUnicode(const std::wstring& input,
+                                  std::wstring& output,
+                                  std::vector<int32_t>& codepoints) const {
+  ssize_t length = 0;
+  int boundclass = 0;  // UTF8PROC_BOUNDCLASS_START
+
+  // The input is truncated at the first null character, as with WstrToStr
+  for (size_t i = 0; i < input.size() && input[i]; ++i) {
+    int32_t c = input[i];
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < input.size() &&
+        input[i + 1] >= 0xDC00 && input[i + 1] <= 0xDFFF) {
+      c = 0x10000 + ((c - 0xD800) << 10) + (input[++i] - 0xDC00);
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+      c = 0xFFFD;  // Unpaired surrogate, replaced as WideCharToMultiByte does
+    }
+
+    for (;;) {
+      const int previous_boundclass = boundclass;
+      const ssize_t available = static_cast<ssize_t>(codepoints.size()) - length;
+      ssize_t result = utf8proc_decompose_char(
+          c, available > 0 ? &codepoints[length] : nullptr, available,
+          kUnicodeOptions, &boundclass);
+      if (result < 0) {
+        output = input;
+        return;
+      }
+      if (result <= available) {
+        length += result;
+        break;
+      }
+      boundclass = previous_boundclass;
+      codepoints.resize(max(codepoints.size() * 2,
+                            static_cast<size_t>(length + result)));
+    }
+  }
 
-  for (const auto& value : values)
-    for (const auto& season : value.second)
-      ReplaceString(str, 0, season, value.first, true, true);
-}
-
-void Engine::Transliterate(std::wstring& str) const {
-  for (size_t i = 0; i < str.size(); ++i) {
-    auto& c = str[i];
-    switch (c) {
-      // Character equivalencies
-      case L'\u00D7': c = L'x'; break;  // multiplication sign (e.g. "Tasogare Otome x Amnesia")
-      // A few common always-equivalent romanizations
-      case L'\u014C': str.replace(i, 1, L"ou"); break;  // latin capital letter o with macron
-      case L'\u014D': str.replace(i, 1, L"ou"); break;  // latin small letter o with macron
-      case L'\u016B': str.replace(i, 1, L"uu"); break;  // latin small letter u with macron
+  // Canonical ordering, as in utf8proc_decompose
+  for (ssize_t pos = 0; pos < length - 1; ) {
+    const int32_t c1 = codepoints[pos];
+    const int32_t c2 = codepoints[pos + 1];
+    const auto property1 = utf8proc_get_property(c1);
+    const auto property2 = utf8proc_get_property(c2);
+    if (property1->combining_class > property2->combining_class &&
+        property2->combining_class > 0) {
+      codepoints[pos] = c2;
+      codepoints[pos + 1] = c1;
+      if (pos > 0) pos--; else pos++;
+    } else {
+      pos++;
     }
   }
 
-  // Romanizations (Hepburn to Wapuro)
-  ReplaceString(str, 0, L"wa", L"ha", true, true);
-  ReplaceString(str, 0, L"e", L"he", true, true);
-  ReplaceString(str, 0, L"o", L"wo", true, true);
+  // utf8proc_reencode composes characters and encodes the result as UTF-8 in
+  // place, which needs one spare element at the end of the buffer.
+  if (codepoints.size() <= static_cast<size_t>(length))
+    codepoints.resize(length + 1);
+  length = utf8proc_reencode(&codepoints[0], length, kUnicodeOptions);
+  if (length < 0) {
+    output = input;
+    return;
+  }
+
+  output.clear();
+  const uint8_t* str = reinterpret_cast<const uint8_t*>(&codepoints[0]);
+  for (ssize_t pos = 0; pos < length && str[pos]; ) {
+    int32_t c = 0;
+    if (str[pos] < 0x80) {
+      c = str[pos++];
+    } else if (str[pos] < 0xE0) {
+      c = ((str[pos] & 0x1F) << 6) | (str[pos + 1] & 0x3F);
+      pos += 2;
+    } else if (str[pos] < 0xF0) {
+      c = ((str[pos] & 0x0F) << 12) | ((str[pos + 1] & 0x3F) << 6) |
+          (str[pos + 2] & 0x3F);
+      pos += 3;
+    } else {
+      c = ((str[pos] & 0x07) << 18) | ((str[pos + 1] & 0x3F) << 12) |
+          ((str[pos + 2] & 0x3F) << 6) | (str[pos + 3] & 0x3F);
+      pos += 4;
+    }
+    if (c >= 0x10000) {
+      c -= 0x10000;
+      output.push_back(static_cast<wchar_t>(0xD800 + (c >> 10)));
+      output.push_back(static_cast<wchar_t>(0xDC00 + (c & 0x3FF)));
+    } else {
+      output.push_back(static_cast<wchar_t>(c));
+    }
+  }
 }
 
-void Engine::NormalizeUnicode(std::wstring& str) const {
-  static const int options =
-      // NFKC normalization according to Unicode Standard Annex #15
-      UTF8PROC_COMPAT | UTF8PROC_COMPOSE | UTF8PROC_STABLE |
-      // Strip "default ignorable" characters, control characters, character
-      // marks (accents, diaeresis)
-      UTF8PROC_IGNORE | UTF8PROC_STRIPCC | UTF8PROC_STRIPMARK |
-      // Map certain characters (e.g. hyphen and minus) for easier comparison
-      UTF8PROC_LUMP |
-      // Perform unicode case folding for case-insensitive comparison
-      UTF8PROC_CASEFOLD;
+// Emulates ReplaceString with each pattern in turn, on whole words
+void Normalizer::ConvertSeasonNumbers(std::vector<Buffer::Word>& words) const {
+  for (const auto& rule : season_rules_) {
+    const size_t count = rule.words.size();
+    for (size_t i = 0; i + count <= words.size(); ++i) {
+      bool matched = true;
+      for (size_t j = 0; j < count && matched; ++j) {
+        const auto& word = words[i + j];
+        const auto& pattern = rule.words[j];
+        matched = word.length == pattern.size() &&
+                  std::char_traits<wchar_t>::compare(pattern.data(), word.data,
+                                                     word.length) == 0;
+      }
+      if (matched) {
+        words[i].data = rule.value.data();
+        words[i].length = rule.value.size();
+        words.erase(words.begin() + i + 1, words.begin() + i + count);
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TitleTable::TitleTable()
+    : entry_count_(0),
+      free_nodes_(0),
+      node_count_(0),
+      unused_string_length_(0) {
+  Node sentinel = {anime::ID_UNKNOWN, 0, 0};
+  nodes_.push_back(sentinel);  // Node 0 marks the end of a list
+}
 
-  char* buffer = nullptr;
-  std::string temp = WstrToStr(str);
+void TitleTable::Add(const std::wstring& title, TitleType type, int anime_id) {
+  if ((entry_count_ + 1) * 2 > entries_.size())
+    Grow();
 
-  int length = utf8proc_map(
-      reinterpret_cast<const uint8_t*>(temp.data()), temp.length(),
-      reinterpret_cast<uint8_t**>(&buffer), options);
+  const unsigned int hash = HashTitle(title.data(), title.size());
+  auto& entry = entries_[FindSlot(title.data(), title.size(), hash)];
 
-  if (length >= 0) {
-    temp.assign(buffer, length);
-    str = StrToWstr(temp);
+  if (entry.offset == kEmptyEntry) {
+    entry.hash = hash;
+    entry.offset = static_cast<unsigned int>(strings_.size());
+    entry.length = static_cast<unsigned int>(title.size());
+    std::fill_n(entry.ids, static_cast<size_t>(kTitleTypeCount), 0);
+    strings_.insert(strings_.end(), title.begin(), title.end());
+    entry_count_++;
   }
 
-  if (buffer)
-    free(buffer);
+  for (unsigned int i = entry.ids[type]; i; i = nodes_[i].next) {
+    if (nodes_[i].anime_id == anime_id) {
+      nodes_[i].count++;
+      return;
+    }
+  }
+
+  Node node = {anime_id, 1, entry.ids[type]};
+  if (free_nodes_) {
+    const unsigned int i = free_nodes_;
+    free_nodes_ = nodes_[i].next;
+    nodes_[i] = node;
+    entry.ids[type] = i;
+  } else {
+    entry.ids[type] = static_cast<unsigned int>(nodes_.size());
+    nodes_.push_back(node);
+  }
+  node_count_++;
 }
 
-// TODO: Rename
-void Engine::EraseUnnecessary(std::wstring& str) const {
-  ReplaceString(str, 0, L"&", L"and", true, true);
-  ReplaceString(str, 0, L"the", L"", true, true);
-  ReplaceString(str, 0, L"episode", L"", true, true);
-  ReplaceString(str, 0, L"specials", L"special", true, true);
+void TitleTable::Remove(const std::wstring& title, TitleType type,
+                        int anime_id) {
+  if (entries_.empty())
+    return;
+
+  const unsigned int hash = HashTitle(title.data(), title.size());
+  const size_t slot = FindSlot(title.data(), title.size(), hash);
+  auto& entry = entries_[slot];
+
+  if (entry.offset == kEmptyEntry)
+    return;
+
+  for (unsigned int* link = &entry.ids[type]; *link; link = &nodes_[*link].next) {
+    const unsigned int i = *link;
+    if (nodes_[i].anime_id == anime_id) {
+      if (--nodes_[i].count == 0) {
+        *link = nodes_[i].next;
+        nodes_[i].next = free_nodes_;
+        free_nodes_ = i;
+        node_count_--;
+      }
+      break;
+    }
+  }
+
+  if (std::count(entry.ids, entry.ids + kTitleTypeCount, 0) == kTitleTypeCount) {
+    EraseSlot(slot);
+    if (unused_string_length_ > 1024 &&
+        unused_string_length_ > strings_.size() / 2)
+      CompactStrings();
+  }
 }
 
-void Engine::ErasePunctuation(std::wstring& str) const {
-  auto it = std::remove_if(str.begin(), str.end(),
-      [](wchar_t c) -> bool {
-        // Control codes, white-space and punctuation characters
-        if (c <= 255 && !isalnum(c))
-          return true;
-        // Unicode stars, hearts, notes, etc. (0x2000-0x2767)
-        if (c > 8192 && c < 10087)
-          return true;
-        // Valid character
-        return false;
-      });
+const TitleTable::Entry* TitleTable::Find(const std::wstring& title) const {
+  if (entries_.empty())
+    return nullptr;
+
+  const unsigned int hash = HashTitle(title.data(), title.size());
+  const auto& entry = entries_[FindSlot(title.data(), title.size(), hash)];
+
+  return entry.offset != kEmptyEntry ? &entry : nullptr;
+}
+
+bool TitleTable::GetIds(const Entry* entry, TitleType type,
+                        std::set<int>& anime_ids) const {
+  if (!entry || !entry->ids[type])
+    return false;
+
+  for (unsigned int i = entry->ids[type]; i; i = nodes_[i].next)
+    anime_ids.insert(nodes_[i].anime_id);
+
+  return true;
+}
+
+size_t TitleTable::entry_count() const {
+  return entry_count_;
+}
+
+size_t TitleTable::node_count() const {
+  return node_count_;
+}
+
+// Returns the slot of the title, or the empty slot where it would be inserted
+size_t TitleTable::FindSlot(const wchar_t* title, size_t length,
+                            unsigned int hash) const {
+  const size_t mask = entries_.size() - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    const auto& entry = entries_[i];
+    if (entry.offset == kEmptyEntry)
+      return i;
+    if (entry.hash == hash && entry.length == length &&
+        std::char_traits<wchar_t>::compare(strings_.data() + entry.offset,
+                                           title, length) == 0)
+      return i;
+  }
+}
 
-  if (it != str.end())
-    str.resize(std::distance(str.begin(), it));
+// Removes an entry by moving the entries after it back, so that no entry is
+// separated from its ideal slot by an empty one
+void TitleTable::EraseSlot(size_t slot) {
+  const size_t mask = entries_.size() - 1;
+
+  unused_string_length_ += entries_[slot].length;
+
+  for (size_t i = (slot + 1) & mask; entries_[i].offset != kEmptyEntry;
+       i = (i + 1) & mask) {
+    const size_t ideal_slot = entries_[i].hash & mask;
+    const bool stays = slot <= i ? (slot < ideal_slot && ideal_slot <= i) :
+                                   (slot < ideal_slot || ideal_slot <= i);
+    if (!stays) {
+      entries_[slot] = entries_[i];
+      slot = i;
+    }
+  }
+
+  entries_[slot].offset = kEmptyEntry;
+  entry_count_--;
+}
+
+// Titles of removed entries stay in the pool until there are enough of them
+void TitleTable::CompactStrings() {
+  std::vector<wchar_t> strings;
+  strings.reserve(strings_.size() - unused_string_length_);
+
+  for (auto& entry : entries_) {
+    if (entry.offset == kEmptyEntry)
+      continue;
+    const unsigned int offset = static_cast<unsigned int>(strings.size());
+    strings.insert(strings.end(), strings_.begin() + entry.offset,
+                   strings_.begin() + entry.offset + entry.length);
+    entry.offset = offset;
+  }
+
+  strings_.swap(strings);
+  unused_string_length_ = 0;
+}
+
+void TitleTable::Grow() {
+  std::vector<Entry> entries;
+  entries.swap(entries_);
+
+  Entry empty_entry = {0, kEmptyEntry, 0, {0}};
+  entries_.resize(max(entries.size() * 2, static_cast<size_t>(1024)),
+                  empty_entry);
+
+  const size_t mask = entries_.size() - 1;
+  for (const auto& entry : entries) {
+    if (entry.offset == kEmptyEntry)
+      continue;
+    size_t i = entry.hash & mask;
+    while (entries_[i].offset != kEmptyEntry)
+      i = (i + 1) & mask;
+    entries_[i] = entry;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+size_t TrigramIndex::TrigramHash::operator()(const trigram_t& trigram) const {
+  unsigned __int64 value = (static_cast<unsigned __int64>(trigram[0]) << 32) |
+                           (static_cast<unsigned __int64>(trigram[1]) << 16) |
+                           static_cast<unsigned __int64>(trigram[2]);
+  return std::hash<unsigned __int64>()(value);
+}
+
+size_t TrigramIndex::Add(int anime_id, const trigram_container_t& trigrams) {
+  Title new_title = {anime_id, trigrams.size()};
+
+  size_t title = titles_.size();
+  if (!free_titles_.empty()) {
+    title = free_titles_.back();
+    free_titles_.pop_back();
+    titles_[title] = new_title;
+  } else {
+    titles_.push_back(new_title);
+  }
+
+  // Trigrams are sorted, so equal ones are next to each other
+  for (auto it = trigrams.begin(); it != trigrams.end(); ) {
+    auto next = std::find_if(it, trigrams.end(),
+        [&](const trigram_t& trigram) { return trigram != *it; });
+    Posting posting = {title, static_cast<size_t>(next - it)};
+    postings_[*it].push_back(posting);
+    it = next;
+  }
+
+  return title;
+}
+
+void TrigramIndex::Remove(size_t title, const trigram_container_t& trigrams) {
+  for (auto it = trigrams.begin(); it != trigrams.end(); ) {
+    auto next = std::find_if(it, trigrams.end(),
+        [&](const trigram_t& trigram) { return trigram != *it; });
+    auto postings = postings_.find(*it);
+    if (postings != postings_.end()) {
+      auto& list = postings->second;
+      list.erase(std::remove_if(list.begin(), list.end(),
+          [&title](const Posting& posting) { return posting.title == title; }),
+          list.end());
+      if (list.empty())
+        postings_.erase(postings);
+    }
+    it = next;
+  }
+
+  titles_[title].anime_id = anime::ID_UNKNOWN;
+  free_titles_.push_back(title);
+}
+
+size_t TrigramIndex::title_count() const {
+  return titles_.size() - free_titles_.size();
+}
+
+size_t TrigramIndex::trigram_count() const {
+  return postings_.size();
+}
+
+size_t TrigramIndex::posting_count() const {
+  size_t count = 0;
+  for (const auto& it : postings_)
+    count += it.second.size();
+  return count;
+}
+
+void TrigramIndex::Search(const trigram_container_t& trigrams,
+                          double threshold, Buffer& buffer,
+                          scores_t& results) const {
+  // Size of the intersection with each title, as set_intersection would count
+  // it for sorted ranges (i.e. the smaller count of each common trigram)
+  auto& intersections = buffer.intersections;
+  auto& candidates = buffer.candidates;
+  if (intersections.size() < titles_.size())
+    intersections.resize(titles_.size());
+  candidates.clear();
+
+  for (auto it = trigrams.begin(); it != trigrams.end(); ) {
+    auto next = std::find_if(it, trigrams.end(),
+        [&](const trigram_t& trigram) { return trigram != *it; });
+    const size_t count = static_cast<size_t>(next - it);
+
+    auto postings = postings_.find(*it);
+    if (postings != postings_.end()) {
+      for (const auto& posting : postings->second) {
+        if (!intersections[posting.title])
+          candidates.push_back(posting.title);
+        intersections[posting.title] += min(count, posting.count);
+      }
+    }
+
+    it = next;
+  }
+
+  for (const auto& title : candidates) {
+    const auto& title_data = titles_[title];
+    double result = static_cast<double>(intersections[title]) /
+        static_cast<double>(max(trigrams.size(), title_data.cardinality));
+    if (result > threshold) {
+      auto& value = results[title_data.anime_id];
+      value = max(value, result);
+    }
+    // Only the slots of this search are reset for the next one
+    intersections[title] = 0;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -419,7 +1146,9 @@ sorted_scores_t Engine::GetScores() const {
 }
 
 int Engine::ScoreTitle(const anime::Episode& episode,
-                       const std::set<int>& anime_ids) {
+                       const std::set<int>& anime_ids,
+                       TrigramIndex::Buffer& trigram_buffer,
+                       sorted_scores_t& scores) const {
   scores_t trigram_results;
 
   auto title = episode.title;
@@ -428,45 +1157,54 @@ int Engine::ScoreTitle(const anime::Episode& episode,
   trigram_container_t t1;
   GetTrigrams(title, t1);
 
-  for (const auto& it : AnimeDatabase.items) {
-    const int anime_id = it.first;
+  trigram_index_.Search(t1, 0.1, trigram_buffer, trigram_results);
 
-    if (!anime_ids.empty() && anime_ids.find(anime_id) == anime_ids.end())
-      continue;
-
-    for (const auto& t2 : trigrams_[anime_id]) {
-      double result = CompareTrigrams(t1, t2);
-      if (result > 0.1)
-        trigram_results[anime_id] = max(trigram_results[anime_id], result);
+  for (auto it = trigram_results.begin(); it != trigram_results.end(); ) {
+    const int anime_id = it->first;
+    if ((!anime_ids.empty() && anime_ids.find(anime_id) == anime_ids.end()) ||
+        !AnimeDatabase.FindItem(anime_id)) {
+      it = trigram_results.erase(it);
+    } else {
+      ++it;
     }
   }
 
-  return ScoreTitle(title, episode, trigram_results);
+  return ScoreTitle(title, episode, trigram_results, scores);
 }
 
 int Engine::ScoreTitle(const std::wstring& str, const anime::Episode& episode,
-                       const scores_t& trigram_results) {
+                       const scores_t& trigram_results,
+                       sorted_scores_t& scores) const {
   scores_t levenshtein;
   scores_t jaro_winkler;
   scores_t subsequence;
   scores_t substring;
   scores_t custom;
 
+  StringSimilarityBuffer buffer;  // Reused for every title
+  const UINT64 character_mask = GetCharacterMask(str);
+
   for (const auto& it : trigram_results) {
     int id = it.first;
 
-    std::vector<std::wstring> titles;
-    anime::GetAllTitles(id, titles);
+    auto indexed_titles = indexed_titles_.find(id);
+    if (indexed_titles == indexed_titles_.end())
+      continue;
 
-    for (auto& title : titles) {
-      ToLower(title);
+    for (const auto& indexed_title : indexed_titles->second) {
+      const auto& profile = indexed_title.profile;
+      const auto& title = profile.title;
 
       auto len = static_cast<double>(max(title.size(), str.size()));
 
-      levenshtein[id] = max(levenshtein[id], LevenshteinDistance(title, str));
-      jaro_winkler[id] = max(jaro_winkler[id], JaroWinklerDistance(title, str));
-      subsequence[id] = max(subsequence[id], LongestCommonSubsequenceLength(title, str) / len);
-      substring[id] = max(substring[id], LongestCommonSubstringLength(title, str) / len);
+      levenshtein[id] = max(levenshtein[id], LevenshteinDistance(title, str, buffer));
+      jaro_winkler[id] = max(jaro_winkler[id], JaroWinklerDistance(title, str, buffer));
+      subsequence[id] = max(subsequence[id], LongestCommonSubsequenceLength(title, str, buffer) / len);
+      substring[id] = max(substring[id], LongestCommonSubstringLength(title, str, buffer) / len);
+
+      // str can't be a part of the title if it has any other characters
+      if ((character_mask & ~profile.character_mask) != 0)
+        continue;
 
       auto val_temp = (title.length() - str.length()) / len;
       if (StartsWith(title, str)) {
@@ -477,7 +1215,7 @@ int Engine::ScoreTitle(const std::wstring& str, const anime::Episode& episode,
     }
   }
 
-  scores_.clear();
+  scores.clear();
   for (const auto& it : trigram_results) {
     int id = it.first;
     double value = ((1.0 * it.second +
@@ -486,19 +1224,19 @@ int Engine::ScoreTitle(const std::wstring& str, const anime::Episode& episode,
                      0.6 * substring[id] +
                      2.0 * jaro_winkler[id]) / 4.5) + custom[id];
     if (value >= 0.5)
-      scores_.push_back(std::make_pair(id, value));
+      scores.push_back(std::make_pair(id, value));
   }
-  std::stable_sort(scores_.begin(), scores_.end(),
+  std::stable_sort(scores.begin(), scores.end(),
       [&](const std::pair<int, double>& a,
           const std::pair<int, double>& b) -> bool {
         return a.second > b.second;
       });
 
-  double score_1st = scores_.size() > 0 ? scores_.at(0).second : 0.0;
-  double score_2nd = scores_.size() > 1 ? scores_.at(1).second : 0.0;
+  double score_1st = scores.size() > 0 ? scores.at(0).second : 0.0;
+  double score_2nd = scores.size() > 1 ? scores.at(1).second : 0.0;
 
   if (score_1st > 1.0 && score_1st != score_2nd)
-    return scores_.front().first;
+    return scores.front().first;
 
   return anime::ID_UNKNOWN;
 }
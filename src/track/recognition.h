@@ -19,9 +19,11 @@
 #ifndef TAIGA_TRACK_RECOGNITION_H
 #define TAIGA_TRACK_RECOGNITION_H
 
+#include <cstdint>
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "base/string.h"
@@ -36,7 +38,6 @@ namespace recognition {
 
 typedef std::map<int, double> scores_t;
 typedef std::vector<std::pair<int, double>> sorted_scores_t;
-typedef std::map<std::wstring, std::set<int>> title_container_t;
 
 class MatchOptions {
 public:
@@ -48,45 +49,251 @@ public:
   bool validate_episode_number;
 };
 
-class Titles {
+enum TitleType {
+  kTitleTypeMain,
+  kTitleTypeAlternative,
+  kTitleTypeUser,
+  kTitleTypeCount
+};
+
+// Maps titles to the IDs of anime that have them, for each type of title. Each
+// title is stored once in a string pool, and entries are found by open
+// addressing, so that a lookup takes one hash and usually a single probe.
+class TitleTable {
 public:
-  title_container_t alternative;
-  title_container_t main;
-  title_container_t user;
+  struct Entry {
+    unsigned int hash;
+    unsigned int offset;  // Position of the title in the string pool
+    unsigned int length;
+    unsigned int ids[kTitleTypeCount];  // First node of each ID list, or 0
+  };
+
+  TitleTable();
+
+  void Add(const std::wstring& title, TitleType type, int anime_id);
+  void Remove(const std::wstring& title, TitleType type, int anime_id);
+  const Entry* Find(const std::wstring& title) const;
+
+  // Inserts the IDs of an entry into the set. Returns false if there are none.
+  bool GetIds(const Entry* entry, TitleType type, std::set<int>& anime_ids) const;
+
+  size_t entry_count() const;
+  size_t node_count() const;
+
+private:
+  // An ID is added once for each title that maps to the same entry (e.g. two
+  // titles with the same normalized form), and removed when its count is 0.
+  struct Node {
+    int anime_id;
+    unsigned int count;
+    unsigned int next;
+  };
+
+  size_t FindSlot(const wchar_t* title, size_t length, unsigned int hash) const;
+  void EraseSlot(size_t slot);
+  void CompactStrings();
+  void Grow();
+
+  std::vector<Entry> entries_;
+  size_t entry_count_;
+  std::vector<Node> nodes_;
+  unsigned int free_nodes_;  // First node of the list of removed nodes, or 0
+  size_t node_count_;
+  std::vector<wchar_t> strings_;
+  size_t unused_string_length_;
+};
+
+// Lower-cased title of an anime as it is compared in Engine::ScoreTitle, so
+// that titles don't have to be copied and converted for each comparison
+class TitleProfile {
+public:
+  std::wstring title;
+  UINT64 character_mask;  // Bit (c % 64) is set for each character c
+};
+
+// Maps each trigram to the titles that contain it, so that the titles which
+// are similar to a given one can be found without comparing it against every
+// title in the database. Results are the same as those of CompareTrigrams.
+class TrigramIndex {
+public:
+  // Scratch space that can be reused across searches, so that each search
+  // costs as much as the postings it reads, rather than the number of titles.
+  // A buffer must not be shared between threads.
+  class Buffer {
+  public:
+    friend class TrigramIndex;
+
+  private:
+    std::vector<size_t> intersections;  // Zero except during a search
+    std::vector<size_t> candidates;
+  };
+
+  // Returns a handle to the title, which is used to remove it
+  size_t Add(int anime_id, const trigram_container_t& trigrams);
+  void Remove(size_t title, const trigram_container_t& trigrams);
+  void Search(const trigram_container_t& trigrams, double threshold,
+              Buffer& buffer, scores_t& results) const;
+
+  size_t title_count() const;
+  size_t trigram_count() const;
+  size_t posting_count() const;
+
+private:
+  struct Posting {
+    size_t title;
+    size_t count;
+  };
+  struct Title {
+    int anime_id;
+    size_t cardinality;
+  };
+  struct TrigramHash {
+    size_t operator()(const trigram_t& trigram) const;
+  };
+
+  std::unordered_map<trigram_t, std::vector<Posting>, TrigramHash> postings_;
+  std::vector<Title> titles_;
+  std::vector<size_t> free_titles_;
+};
+
+// Sizes of the title indexes of the recognition engine, to make sure that
+// they don't grow over time as titles are updated
+class IndexSize {
+public:
+  size_t anime;
+  size_t titles;
+  size_t title_entries;
+  size_t title_ids;
+  size_t normal_title_entries;
+  size_t normal_title_ids;
+  size_t trigram_titles;
+  size_t trigrams;
+  size_t trigram_postings;
+};
+
+// Normalizes titles for comparison in a few linear passes, instead of one
+// ReplaceString pass per rule. Rules are compiled into word maps once, on
+// construction.
+class Normalizer {
+public:
+  // Scratch space that can be reused across calls to avoid reallocations. A
+  // buffer must not be shared between threads.
+  class Buffer {
+  public:
+    friend class Normalizer;
+
+  private:
+    struct Word {
+      const wchar_t* data;
+      size_t length;
+    };
+
+    std::wstring text;
+    std::wstring normal_text;
+    std::vector<int32_t> codepoints;
+    std::vector<Word> words;
+  };
+
+  Normalizer();
+
+  void Normalize(std::wstring& title, Buffer& buffer) const;
+
+private:
+  // Maps whole words to their replacements. Words are grouped by length, and
+  // there are only a few of them in each group.
+  class WordMap {
+  public:
+    void Add(const std::wstring& word, const std::wstring& replacement);
+    const std::wstring* Find(const wchar_t* word, size_t length) const;
+
+  private:
+    std::vector<std::vector<std::pair<std::wstring, std::wstring>>> words_;
+  };
+
+  struct SeasonRule {
+    std::vector<std::wstring> words;
+    std::wstring value;
+  };
+
+  void Transliterate(const std::wstring& input, std::wstring& output) const;
+  void NormalizeUnicode(const std::wstring& input, std::wstring& output,
+                        std::vector<int32_t>& codepoints) const;
+  void ConvertSeasonNumbers(std::vector<Buffer::Word>& words) const;
+
+  WordMap ordinal_numbers_;
+  WordMap roman_numbers_;
+  WordMap romanizations_;
+  WordMap season_numbers_;
+  std::vector<SeasonRule> season_rules_;
+  std::wstring season_word_;
+  WordMap unnecessary_words_;
 };
 
 class Engine {
 public:
+  Engine();
+
   bool Parse(std::wstring title, anime::Episode& episode) const;
   int Identify(anime::Episode& episode, bool give_score, const MatchOptions& match_options);
 
+  // Identifies a batch of parsed episodes using all available processors.
+  // Results are the same as calling Identify for each episode, except that
+  // GetScores() is left untouched.
+  void IdentifyBatch(std::vector<anime::Episode>& episodes, const MatchOptions& match_options, bool give_score = false);
+
+  // Indexes the titles of an item. Titles that the item no longer has are
+  // removed from the indexes, and titles that are unchanged are kept as is.
   void UpdateTitles(const anime::Item& anime_item);
+  void RemoveItem(int anime_id);
+  // Removes every title from the indexes. Titles are indexed again from the
+  // anime database the next time they're needed.
+  void Clear();
+
+  // Changes whenever a title is added to or removed from the indexes, e.g. when
+  // the user edits synonyms. It only depends on the titles themselves, so it
+  // stays the same across sessions if they do.
+  UINT64 GetTitleSignature();
+
+  IndexSize GetIndexSize() const;
 
   sorted_scores_t GetScores() const;
 
 private:
+  class IndexedTitle {
+  public:
+    std::wstring title;
+    std::wstring normal_title;
+    TitleType type;
+    size_t trigram_title;
+    TitleProfile profile;
+  };
+
+  int IdentifyEpisode(anime::Episode& episode, bool give_score, const MatchOptions& match_options, TrigramIndex::Buffer& trigram_buffer, sorted_scores_t& scores) const;
+
   bool ValidateOptions(anime::Episode& episode, int anime_id, const MatchOptions& match_options) const;
   int ValidateEpisodeNumber(anime::Episode& episode, const anime::Item& anime_item) const;
 
   void InitializeTitles();
+  IndexedTitle AddTitle(int anime_id, const std::wstring& title, TitleType type);
+  void RemoveTitle(int anime_id, const IndexedTitle& indexed_title);
   int LookUpTitle(const std::wstring& title, const std::wstring& normal_title, std::set<int>& anime_ids) const;
 
-  int ScoreTitle(const anime::Episode& episode, const std::set<int>& anime_ids);
-  int ScoreTitle(const std::wstring& str, const anime::Episode& episode, const scores_t& trigram_results);
+  int ScoreTitle(const anime::Episode& episode, const std::set<int>& anime_ids, TrigramIndex::Buffer& trigram_buffer, sorted_scores_t& scores) const;
+  int ScoreTitle(const std::wstring& str, const anime::Episode& episode, const scores_t& trigram_results, sorted_scores_t& scores) const;
 
   void Normalize(std::wstring& title) const;
-  void NormalizeUnicode(std::wstring& str) const;
-  void ErasePunctuation(std::wstring& str) const;
-  void EraseUnnecessary(std::wstring& str) const;
-  void ConvertOrdinalNumbers(std::wstring& str) const;
-  void ConvertRomanNumbers(std::wstring& str) const;
-  void ConvertSeasonNumbers(std::wstring& str) const;
-  void Transliterate(std::wstring& str) const;
-
-  Titles titles_;
-  Titles normal_titles_;
+
+  Normalizer normalizer_;
+  // Titles are parsed and indexed on the calling thread only
+  mutable Normalizer::Buffer normalizer_buffer_;
+  TitleTable titles_;
+  TitleTable normal_titles_;
+  std::unordered_map<int, std::vector<IndexedTitle>> indexed_titles_;
   sorted_scores_t scores_;
-  std::map<int, std::vector<trigram_container_t>> trigrams_;
+  UINT64 title_signature_;
+  bool titles_initialized_;
+  TrigramIndex trigram_index_;
+  TrigramIndex::Buffer trigram_buffer_;
 };
 
 }  // namespace recognition
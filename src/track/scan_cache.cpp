@@ -0,0 +1,325 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "base/file.h"
+#include "base/foreach.h"
+#include "base/string.h"
+#include "base/xml.h"
+#include "library/anime.h"
+#include "library/anime_util.h"
+#include "taiga/path.h"
+#include "taiga/taiga.h"
+#include "track/scan_cache.h"
+
+ScanCache scan_cache;
+
+// Must be increased whenever recognition changes in a way that makes earlier
+// results invalid
+const int kScanCacheVersion = 2;
+
+// Files that were modified recently might still be written to, for instance by
+// a torrent client. Directories that contain such files are read again on the
+// next scan.
+const ULONGLONG kStableAge = 60ULL * 60 * 10000000;  // 1 hour, in 100ns units
+
+static ULONGLONG FileTimeToUint64(const FILETIME& file_time) {
+  return (static_cast<ULONGLONG>(file_time.dwHighDateTime) << 32) |
+         file_time.dwLowDateTime;
+}
+
+static ULONGLONG GetCurrentFileTime() {
+  FILETIME file_time;
+  GetSystemTimeAsFileTime(&file_time);
+  return FileTimeToUint64(file_time);
+}
+
+static std::wstring GetCacheVersion() {
+  return ToWstr(kScanCacheVersion) + L"/" + std::wstring(Taiga.version);
+}
+
+ScanCache::Directory::Directory()
+    : stamp(0),
+      last_index(0) {
+}
+
+ScanCache::ScanCache()
+    : loaded_(false),
+      modified_(false) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ScanCache::Load() {
+  win::Lock lock(critical_section_);
+
+  if (loaded_)
+    return true;
+  loaded_ = true;
+
+  xml_document document;
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseScanCache);
+  xml_parse_result parse_result = document.load_file(path.c_str());
+
+  if (parse_result.status != pugi::status_ok)
+    return false;
+
+  xml_node node_cache = document.child(L"scan_cache");
+  if (GetCacheVersion() != node_cache.attribute(L"version").value())
+    return false;
+
+  foreach_xmlnode_(node_directory, node_cache, L"directory") {
+    Directory& directory =
+        directories_[node_directory.attribute(L"path").value()];
+    directory.stamp = node_directory.attribute(L"stamp").as_ullong();
+    foreach_xmlnode_(node_entry, node_directory, L"entry") {
+      Entry entry;
+      entry.name = node_entry.attribute(L"name").value();
+      entry.attributes = node_entry.attribute(L"attributes").as_uint();
+      entry.size = node_entry.attribute(L"size").as_ullong();
+      entry.write_time = node_entry.attribute(L"time").as_ullong();
+      entry.anime_id = node_entry.attribute(L"anime_id").as_int(anime::ID_UNKNOWN);
+      entry.number = node_entry.attribute(L"episode").value();
+      entry.title_signature = node_entry.attribute(L"titles").as_ullong();
+      directory.entries.push_back(entry);
+    }
+  }
+
+  return true;
+}
+
+bool ScanCache::Save() {
+  win::Lock lock(critical_section_);
+
+  if (!modified_)
+    return true;
+
+  xml_document document;
+  xml_node node_cache = document.append_child(L"scan_cache");
+  node_cache.append_attribute(L"version") = GetCacheVersion().c_str();
+
+  foreach_(it, directories_) {
+    xml_node node_directory = node_cache.append_child(L"directory");
+    node_directory.append_attribute(L"path") = it->first.c_str();
+    node_directory.append_attribute(L"stamp") = it->second.stamp;
+    foreach_(entry, it->second.entries) {
+      xml_node node_entry = node_directory.append_child(L"entry");
+      node_entry.append_attribute(L"name") = entry->name.c_str();
+      node_entry.append_attribute(L"attributes") =
+          static_cast<unsigned int>(entry->attributes);
+      node_entry.append_attribute(L"size") = entry->size;
+      node_entry.append_attribute(L"time") = entry->write_time;
+      if (anime::IsValidId(entry->anime_id)) {
+        node_entry.append_attribute(L"anime_id") = entry->anime_id;
+        node_entry.append_attribute(L"episode") = entry->number.c_str();
+        node_entry.append_attribute(L"titles") = entry->title_signature;
+      }
+    }
+  }
+
+  std::wstring path = taiga::GetPath(taiga::kPathDatabaseScanCache);
+  modified_ = !XmlWriteDocumentToFile(document, path);
+
+  return !modified_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ScanCache::Find(const std::wstring& path,
+                     std::vector<DirectoryWalker::Entry>& entries,
+                     unsigned long long& stamp) {
+  stamp = 0;
+
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesEx(GetExtendedLengthPath(path).c_str(),
+                           GetFileExInfoStandard, &data))
+    return false;
+
+  ULONGLONG write_time = FileTimeToUint64(data.ftLastWriteTime);
+  if (write_time + kStableAge > GetCurrentFileTime())
+    return false;
+  stamp = write_time;
+
+  win::Lock lock(critical_section_);
+
+  auto it = directories_.find(path);
+  if (it == directories_.end() || it->second.stamp != stamp)
+    return false;
+
+  entries.clear();
+  entries.reserve(it->second.entries.size());
+  foreach_(cached_entry, it->second.entries) {
+    DirectoryWalker::Entry entry;
+    ZeroMemory(&entry.data, sizeof(entry.data));
+    entry.name = cached_entry->name;
+    entry.directory = (cached_entry->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    entry.hidden = (cached_entry->attributes &
+                    (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) != 0;
+    entry.size = cached_entry->size;
+    entry.data.dwFileAttributes = cached_entry->attributes;
+    entry.data.nFileSizeHigh = static_cast<DWORD>(cached_entry->size >> 32);
+    entry.data.nFileSizeLow = static_cast<DWORD>(cached_entry->size);
+    entry.data.ftLastWriteTime.dwHighDateTime =
+        static_cast<DWORD>(cached_entry->write_time >> 32);
+    entry.data.ftLastWriteTime.dwLowDateTime =
+        static_cast<DWORD>(cached_entry->write_time);
+    wcsncpy_s(entry.data.cFileName, cached_entry->name.c_str(), _TRUNCATE);
+    entries.push_back(entry);
+  }
+
+  return true;
+}
+
+void ScanCache::Store(const std::wstring& path, unsigned long long stamp,
+                      const std::vector<DirectoryWalker::Entry>& entries) {
+  ULONGLONG current_time = GetCurrentFileTime();
+
+  win::Lock lock(critical_section_);
+
+  Directory& directory = directories_[path];
+  std::vector<Entry> new_entries;
+  new_entries.reserve(entries.size());
+
+  foreach_(it, entries) {
+    Entry entry;
+    entry.name = it->name;
+    entry.attributes = it->data.dwFileAttributes;
+    entry.size = it->size;
+    entry.write_time = FileTimeToUint64(it->data.ftLastWriteTime);
+    entry.anime_id = anime::ID_UNKNOWN;
+    entry.title_signature = 0;
+    if (entry.write_time + kStableAge > current_time)
+      stamp = 0;
+    // Keep the results of unchanged entries
+    auto cached_entry = FindEntry(path, it->data);
+    if (cached_entry) {
+      entry.anime_id = cached_entry->anime_id;
+      entry.number = cached_entry->number;
+      entry.title_signature = cached_entry->title_signature;
+    }
+    new_entries.push_back(entry);
+  }
+
+  // Forget about directories that are no longer there
+  foreach_(it, directory.entries) {
+    if (!(it->attributes & FILE_ATTRIBUTE_DIRECTORY))
+      continue;
+    bool found = false;
+    foreach_(entry, new_entries) {
+      if (entry->name == it->name) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      EraseDirectory(AddTrailingSlash(path) + it->name);
+  }
+
+  bool changed = directory.stamp != stamp ||
+                 directory.entries.size() != new_entries.size();
+  for (size_t i = 0; !changed && i < new_entries.size(); i++) {
+    const Entry& a = directory.entries.at(i);
+    const Entry& b = new_entries.at(i);
+    changed = a.name != b.name || a.attributes != b.attributes ||
+              a.size != b.size || a.write_time != b.write_time;
+  }
+
+  if (changed) {
+    directory.stamp = stamp;
+    directory.entries.swap(new_entries);
+    directory.last_index = 0;
+    modified_ = true;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ScanCache::FindEpisode(const std::wstring& root,
+                            const WIN32_FIND_DATA& data,
+                            UINT64 title_signature,
+                            int& anime_id, std::wstring& number) {
+  win::Lock lock(critical_section_);
+
+  auto entry = FindEntry(root, data);
+  if (!entry || !anime::IsValidId(entry->anime_id) ||
+      entry->title_signature != title_signature)
+    return false;
+
+  anime_id = entry->anime_id;
+  number = entry->number;
+  return true;
+}
+
+void ScanCache::StoreEpisode(const std::wstring& root,
+                             const WIN32_FIND_DATA& data,
+                             UINT64 title_signature,
+                             int anime_id, const std::wstring& number) {
+  win::Lock lock(critical_section_);
+
+  auto entry = FindEntry(root, data);
+  if (!entry)
+    return;
+
+  if (entry->anime_id != anime_id || entry->number != number ||
+      entry->title_signature != title_signature) {
+    entry->anime_id = anime_id;
+    entry->number = number;
+    entry->title_signature = title_signature;
+    modified_ = true;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ScanCache::EraseDirectory(const std::wstring& path) {
+  directories_.erase(path);
+
+  std::wstring prefix = AddTrailingSlash(path);
+  auto it = directories_.lower_bound(prefix);
+  while (it != directories_.end() && StartsWith(it->first, prefix))
+    directories_.erase(it++);
+
+  modified_ = true;
+}
+
+// Entries are usually looked up in the order they were stored, so we check
+// the one after the last match first
+ScanCache::Entry* ScanCache::FindEntry(const std::wstring& root,
+                                       const WIN32_FIND_DATA& data) {
+  auto it = directories_.find(root);
+  if (it == directories_.end())
+    return nullptr;
+
+  Directory& directory = it->second;
+  size_t count = directory.entries.size();
+  ULONGLONG size = (static_cast<ULONGLONG>(data.nFileSizeHigh) << 32) |
+                   data.nFileSizeLow;
+  ULONGLONG write_time = FileTimeToUint64(data.ftLastWriteTime);
+
+  for (size_t i = 0; i < count; i++) {
+    size_t index = (directory.last_index + i) % count;
+    Entry& entry = directory.entries.at(index);
+    if (entry.name == data.cFileName) {
+      if (entry.size != size || entry.write_time != write_time)
+        return nullptr;
+      directory.last_index = index + 1;
+      return &entry;
+    }
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,88 @@
+/*
+** Taiga
+** Copyright (C) 2010-2014, Eren Okka
+** 
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+** 
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+** 
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAIGA_TRACK_SCAN_CACHE_H
+#define TAIGA_TRACK_SCAN_CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <windows.h>
+
+#include "base/file_walker.h"
+#include "win/win_thread.h"
+
+// Remembers the contents of the folders that were scanned for episodes, along
+// with the anime and episode numbers that were recognized in them. Folders
+// that haven't changed since the last scan are not read again, and files that
+// haven't changed are not parsed again. Stored in db\scan.xml.
+class ScanCache : public DirectoryCache {
+public:
+  ScanCache();
+  ~ScanCache() {}
+
+  bool Load();
+  bool Save();
+
+  bool Find(const std::wstring& path,
+            std::vector<DirectoryWalker::Entry>& entries,
+            unsigned long long& stamp);
+  void Store(const std::wstring& path, unsigned long long stamp,
+             const std::vector<DirectoryWalker::Entry>& entries);
+
+  // Only positive results are stored, as files that couldn't be recognized
+  // might be recognized once the anime database is updated. Results are kept
+  // along with the title signature of the recognition engine, and ignored if
+  // it has changed since (e.g. user synonyms were edited).
+  bool FindEpisode(const std::wstring& root, const WIN32_FIND_DATA& data,
+                   UINT64 title_signature,
+                   int& anime_id, std::wstring& number);
+  void StoreEpisode(const std::wstring& root, const WIN32_FIND_DATA& data,
+                    UINT64 title_signature,
+                    int anime_id, const std::wstring& number);
+
+private:
+  struct Entry {
+    std::wstring name;
+    DWORD attributes;
+    ULONGLONG size;
+    ULONGLONG write_time;
+    int anime_id;
+    std::wstring number;
+    UINT64 title_signature;
+  };
+
+  struct Directory {
+    Directory();
+    ULONGLONG stamp;  // Zero if the entries can't be reused
+    std::vector<Entry> entries;
+    size_t last_index;
+  };
+
+  void EraseDirectory(const std::wstring& path);
+  Entry* FindEntry(const std::wstring& root, const WIN32_FIND_DATA& data);
+
+  std::map<std::wstring, Directory> directories_;
+  bool loaded_;
+  bool modified_;
+  win::CriticalSection critical_section_;
+};
+
+extern ScanCache scan_cache;
+
+#endif  // TAIGA_TRACK_SCAN_CACHE_H
@@ -25,33 +25,66 @@
 #include "taiga/settings.h"
 #include "taiga/taiga.h"
 #include "track/recognition.h"
+#include "track/scan_cache.h"
 #include "track/search.h"
 #include "ui/ui.h"
 #include "win/win_taskbar.h"
 
 TaigaFileSearchHelper file_search_helper;
 
+// Large enough for the recognition engine to use a few threads, small enough
+// not to delay early exits for long
+const size_t kFileBatchSize = 128;
+
 TaigaFileSearchHelper::TaigaFileSearchHelper()
     : anime_id_(anime::ID_UNKNOWN),
       episode_number_(0) {
   // Here we assume that anything less than 10 MiB can't be a valid episode.
   minimum_file_size_ = 1024 * 1024 * 10;
+
+  directory_cache_ = &scan_cache;
+}
+
+// Returns true if the entry was recognized before with the same titles, and the
+// anime is still in the database
+static bool FindCachedEpisode(const std::wstring& root,
+                              const WIN32_FIND_DATA& data,
+                              anime::Episode& episode) {
+  int anime_id = anime::ID_UNKNOWN;
+  std::wstring number;
+
+  if (!scan_cache.FindEpisode(root, data, Meow.GetTitleSignature(),
+                              anime_id, number))
+    return false;
+  if (!AnimeDatabase.FindItem(anime_id))
+    return false;
+
+  episode.Clear();
+  episode.anime_id = anime_id;
+  episode.number = number;
+  return true;
 }
 
 bool TaigaFileSearchHelper::OnDirectory(const std::wstring& root,
                                         const std::wstring& name,
                                         const WIN32_FIND_DATA& data) {
-  if (!Meow.Parse(name, episode_)) {
-    LOG(LevelDebug, L"Could not parse directory: " + name);
-    return false;
-  }
+  if (!FindCachedEpisode(root, data, episode_)) {
+    if (!Meow.Parse(name, episode_)) {
+      LOG(LevelDebug, L"Could not parse directory: " + name);
+      return false;
+    }
 
-  static track::recognition::MatchOptions match_options;
-  match_options.check_airing_date = false;
-  match_options.check_anime_type = false;
-  match_options.validate_episode_number = false;
+    static track::recognition::MatchOptions match_options;
+    match_options.check_airing_date = false;
+    match_options.check_anime_type = false;
+    match_options.validate_episode_number = false;
+
+    Meow.Identify(episode_, false, match_options);
 
-  Meow.Identify(episode_, false, match_options);
+    if (AnimeDatabase.FindItem(episode_.anime_id))
+      scan_cache.StoreEpisode(root, data, Meow.GetTitleSignature(),
+                              episode_.anime_id, episode_.number);
+  }
 
   anime::Item* anime_item = AnimeDatabase.FindItem(episode_.anime_id);
 
@@ -72,27 +105,56 @@ bool TaigaFileSearchHelper::OnDirectory(const std::wstring& root,
 bool TaigaFileSearchHelper::OnFile(const std::wstring& root,
                                    const std::wstring& name,
                                    const WIN32_FIND_DATA& data) {
-  if (!Meow.Parse(name, episode_)) {
+  anime::Episode episode;
+  bool identified = FindCachedEpisode(root, data, episode);
+
+  // Files that are already identified don't have to wait for the others,
+  // unless that would change the order in which files are handled
+  if (identified && pending_files_.empty())
+    return HandleFile(root, name, episode);
+
+  if (!identified && !Meow.Parse(name, episode)) {
     LOG(LevelDebug, L"Could not parse filename: " + name);
     return false;
   }
 
-  static track::recognition::MatchOptions match_options;
-  match_options.check_airing_date = true;
-  match_options.check_anime_type = true;
-  match_options.validate_episode_number = true;
+  PendingFile file;
+  file.root = root;
+  file.name = name;
+  file.data = data;
+  file.identified = identified;
+  pending_files_.push_back(file);
+  pending_episodes_.push_back(episode);
+
+  if (pending_files_.size() < kFileBatchSize)
+    return false;
 
-  Meow.Identify(episode_, false, match_options);
+  return IdentifyPendingFiles();
+}
 
-  anime::Item* anime_item = AnimeDatabase.FindItem(episode_.anime_id);
+bool TaigaFileSearchHelper::OnSearchEnd(bool stopped) {
+  if (stopped) {
+    pending_files_.clear();
+    pending_episodes_.clear();
+    return true;
+  }
+
+  return IdentifyPendingFiles();
+}
+
+// Returns true if the file is the one we were looking for
+bool TaigaFileSearchHelper::HandleFile(const std::wstring& root,
+                                       const std::wstring& name,
+                                       const anime::Episode& episode) {
+  anime::Item* anime_item = AnimeDatabase.FindItem(episode.anime_id);
 
   if (anime_item) {
-    int upper_bound = anime::GetEpisodeHigh(episode_.number);
-    int lower_bound = anime::GetEpisodeLow(episode_.number);
+    int upper_bound = anime::GetEpisodeHigh(episode.number);
+    int lower_bound = anime::GetEpisodeLow(episode.number);
 
     if (!anime::IsValidEpisode(upper_bound, anime_item->GetEpisodeCount()) ||
         !anime::IsValidEpisode(lower_bound, anime_item->GetEpisodeCount())) {
-      LOG(LevelDebug, L"Invalid episode number: " + episode_.number + L"\n"
+      LOG(LevelDebug, L"Invalid episode number: " + episode.number + L"\n"
           L"File: " + AddTrailingSlash(root) + name);
       return false;
     }
@@ -118,6 +180,46 @@ bool TaigaFileSearchHelper::OnFile(const std::wstring& root,
   return false;
 }
 
+// Files are handled in the order they were found, and the rest of the batch
+// is dropped once we find what we were looking for
+bool TaigaFileSearchHelper::IdentifyPendingFiles() {
+  std::vector<size_t> indexes;
+  std::vector<anime::Episode> episodes;
+
+  for (size_t i = 0; i < pending_files_.size(); ++i) {
+    if (!pending_files_.at(i).identified) {
+      indexes.push_back(i);
+      episodes.push_back(pending_episodes_.at(i));
+    }
+  }
+
+  static track::recognition::MatchOptions match_options;
+  match_options.check_airing_date = true;
+  match_options.check_anime_type = true;
+  match_options.validate_episode_number = true;
+
+  Meow.IdentifyBatch(episodes, match_options);
+
+  for (size_t i = 0; i < indexes.size(); ++i)
+    pending_episodes_.at(indexes.at(i)) = episodes.at(i);
+
+  bool found = false;
+
+  for (size_t i = 0; i < pending_files_.size() && !found; ++i) {
+    const PendingFile& file = pending_files_.at(i);
+    const anime::Episode& episode = pending_episodes_.at(i);
+    if (!file.identified && AnimeDatabase.FindItem(episode.anime_id))
+      scan_cache.StoreEpisode(file.root, file.data, Meow.GetTitleSignature(),
+                              episode.anime_id, episode.number);
+    found = HandleFile(file.root, file.name, episode);
+  }
+
+  pending_files_.clear();
+  pending_episodes_.clear();
+
+  return found;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 const std::wstring& TaigaFileSearchHelper::path_found() const {
@@ -159,6 +261,8 @@ void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number) {
     ui::ChangeStatusText(L"Scanning available episodes...");
   }
 
+  scan_cache.Load();
+
   file_search_helper.set_anime_id(anime_id);
   file_search_helper.set_episode_number(episode_number);
   file_search_helper.set_path_found(L"");
@@ -208,6 +312,8 @@ void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number) {
     }
   }
 
+  scan_cache.Save();
+
   if (!silent) {
     TaskbarList.SetProgressState(TBPF_NOPROGRESS);
     ui::SetSharedCursor(IDC_ARROW);
@@ -220,6 +326,8 @@ void ScanAvailableEpisodesQuick() {
 }
 
 void ScanAvailableEpisodesQuick(int anime_id) {
+  scan_cache.Load();
+
   foreach_r_(it, AnimeDatabase.items) {
     anime::Item& anime_item = it->second;
 
@@ -238,4 +346,23 @@ void ScanAvailableEpisodesQuick(int anime_id) {
 
     file_search_helper.Search(anime_item.GetFolder());
   }
+
+  scan_cache.Save();
+}
+
+// Used for folders that are added to a root folder, which are not necessarily
+// anime folders themselves
+void ScanAvailableEpisodesInFolder(const std::wstring& path) {
+  scan_cache.Load();
+
+  file_search_helper.set_anime_id(anime::ID_UNKNOWN);
+  file_search_helper.set_episode_number(0);
+  file_search_helper.set_path_found(L"");
+  file_search_helper.set_skip_directories(false);
+  file_search_helper.set_skip_files(false);
+  file_search_helper.set_skip_subdirectories(false);
+
+  file_search_helper.Search(path);
+
+  scan_cache.Save();
 }
\ No newline at end of file
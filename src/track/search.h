@@ -20,6 +20,7 @@
 #define TAIGA_TRACK_SEARCH_H
 
 #include <string>
+#include <vector>
 
 #include "base/file.h"
 #include "library/anime_episode.h"
@@ -31,6 +32,7 @@ public:
 
   bool OnDirectory(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data);
   bool OnFile(const std::wstring& root, const std::wstring& name, const WIN32_FIND_DATA& data);
+  bool OnSearchEnd(bool stopped);
 
   const std::wstring& path_found() const;
 
@@ -39,10 +41,24 @@ public:
   void set_path_found(const std::wstring& path_found);
 
 private:
+  // Files are parsed as they're found, and identified in batches so that the
+  // recognition engine can use multiple threads
+  struct PendingFile {
+    std::wstring root;
+    std::wstring name;
+    WIN32_FIND_DATA data;
+    bool identified;  // Found in the scan cache
+  };
+
+  bool HandleFile(const std::wstring& root, const std::wstring& name, const anime::Episode& episode);
+  bool IdentifyPendingFiles();
+
   int anime_id_;
   anime::Episode episode_;
   int episode_number_;
   std::wstring path_found_;
+  std::vector<PendingFile> pending_files_;
+  std::vector<anime::Episode> pending_episodes_;
 };
 
 extern TaigaFileSearchHelper file_search_helper;
@@ -51,5 +67,6 @@ void ScanAvailableEpisodes(bool silent);
 void ScanAvailableEpisodes(bool silent, int anime_id, int episode_number);
 void ScanAvailableEpisodesQuick();
 void ScanAvailableEpisodesQuick(int anime_id);
+void ScanAvailableEpisodesInFolder(const std::wstring& path);
 
 #endif  // TAIGA_TRACK_SEARCH_H
\ No newline at end of file
@@ -577,8 +577,9 @@ void AnimeDialog::Refresh(bool image, bool series_info, bool my_info, bool conne
     // Available episodes
     int available_episodes = 0;
     foreach_c_(it, AnimeDatabase.items) {
-      if (it->second.IsInList() && it->second.IsNewEpisodeAvailable())
-        available_episodes ++;
+      if (it->second.IsInList())
+        available_episodes += it->second.GetAvailableEpisodes().Count(
+            it->second.GetMyLastWatchedEpisode() + 1, it->second.GetAvailableEpisodeCount());
     }
     if (available_episodes > 0)
       content += L"There are at least " + ToWstr(available_episodes) + L" new episodes available on your computer.\n\n";
@@ -392,7 +392,7 @@ BOOL MainDialog::PreTranslateMessage(MSG* pMsg) {
               Feed* feed = Aggregator.Get(kFeedCategoryLink);
               if (feed) {
                 edit.SetText(L"");
-                feed->Check(Settings[taiga::kTorrent_Discovery_Source]);
+                feed->CheckSources();
                 return TRUE;
               }
               break;
@@ -115,7 +115,7 @@ BOOL TorrentDialog::OnCommand(WPARAM wParam, LPARAM lParam) {
     // Check new torrents
     case 100: {
       DlgMain.edit.SetText(L"");
-      feed->Check(Settings[taiga::kTorrent_Discovery_Source]);
+      feed->CheckSources();
       /**
       #ifdef _DEBUG
       feed->Load();
@@ -138,7 +138,7 @@ BOOL TorrentDialog::OnCommand(WPARAM wParam, LPARAM lParam) {
           if (feed_item) {
             feed_item->state = kFeedItemDiscardedNormal;
             list_.SetCheckState(i, FALSE);
-            Aggregator.file_archive.push_back(feed_item->title);
+            Aggregator.AddToArchive(feed_item->title);
           }
         }
       }
@@ -238,7 +238,7 @@ LRESULT TorrentDialog::OnNotify(int idCtrl, LPNMHDR pnmh) {
           } else if (answer == L"DiscardTorrent") {
             feed_item->state = kFeedItemDiscardedNormal;
             list_.SetCheckState(lpnmitem->iItem, FALSE);
-            Aggregator.file_archive.push_back(feed_item->title);
+            Aggregator.AddToArchive(feed_item->title);
           } else if (answer == L"DiscardTorrents") {
             auto anime_item = AnimeDatabase.FindItem(feed_item->episode_data.anime_id);
             if (anime_item) {